@@ -0,0 +1,145 @@
+/*
+ * Decide how many hosts to run at once, from how quickly they respond.
+ *
+ * This is AIMD, as TCP does it.  We start with a small window of hosts, and
+ * each host that responds quickly lets us start more - one more per host
+ * until the first back off (slow start), then about one more per window of
+ * hosts.  A host that is slow to respond, or that ssh cannot reach, halves
+ * the window, which then stays put until the hosts that were already running
+ * have been heard from.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+
+#include "adaptive.h"
+
+
+/** A response this many times slower than the best is congestion... */
+#define LATENCY_FACTOR 2
+/** ... as long as it is also this much slower (usec). */
+#define LATENCY_SLACK 50000
+/** How many responses before we forget the best latency. */
+#define LATENCY_EPOCH 64
+
+
+static void back_off(Adaptive *a, const char *why);
+
+
+/**
+ * Make a new adaptive window.
+ *
+ * @param start how many hosts to run at first
+ * @param max the most hosts to ever run at once
+ * @param debug 1 to report each back off on stderr, 2 to report each change
+ */
+Adaptive *new_adaptive(int start, int max, int debug)
+{
+	Adaptive *a = g_new0(Adaptive, 1);
+
+	a->max = max;
+	a->window = MIN(start, max);
+	a->threshold = max;
+	a->debug = debug;
+	return a;
+}
+
+
+/**
+ * How many hosts we can run at once right now.
+ */
+int adaptive_limit(Adaptive *a)
+{
+	int w = (int) a->window;
+	return CLAMP(w, 1, a->max);
+}
+
+
+/**
+ * A host responded (its first output, or its exit if it had no output).
+ *
+ * @param usec how long since we started its ssh
+ */
+void adaptive_latency(Adaptive *a, gint64 usec)
+{
+	int old = adaptive_limit(a);
+
+	if (! a->min_latency || usec < a->min_latency) {
+		a->min_latency = usec;
+	}
+	// Let the best latency drift up, in case the network really has got
+	// slower and we'd otherwise keep backing off forever.
+	if (! a->epoch_min || usec < a->epoch_min) {
+		a->epoch_min = usec;
+	}
+	if (++a->epoch_count >= LATENCY_EPOCH) {
+		a->min_latency = a->epoch_min;
+		a->epoch_min = 0;
+		a->epoch_count = 0;
+	}
+
+	// Hosts that started before we backed off tell us nothing new, so
+	// the window neither grows nor shrinks for them.
+	if (a->holdoff) {
+		a->holdoff --;
+		if (! a->holdoff && a->debug > 1) {
+			fprintf(stderr, "adaptive: holdoff over, window %d\n",
+				old);
+		}
+		return;
+	}
+	if (usec > a->min_latency * LATENCY_FACTOR
+	    && usec > a->min_latency + LATENCY_SLACK) {
+		back_off(a, "latency");
+		return;
+	}
+	if (a->window < a->threshold) {
+		a->window += 1;
+	} else {
+		a->window += 1 / a->window;
+	}
+	if (a->window > a->max) {
+		a->window = a->max;
+	}
+	if (a->debug > 1 && adaptive_limit(a) != old) {
+		fprintf(stderr, "adaptive: grow, window %d -> %d\n",
+			old, adaptive_limit(a));
+	}
+}
+
+
+/**
+ * ssh could not reach a host.
+ */
+void adaptive_failure(Adaptive *a)
+{
+	if (a->holdoff) {
+		a->holdoff --;
+	}
+	back_off(a, "ssh failure");
+}
+
+
+/**
+ * Halve the window.  Hosts that were already running when we backed off
+ * will report the same congestion, so we ignore the next window's worth of
+ * responses.
+ */
+static void back_off(Adaptive *a, const char *why)
+{
+	int old = adaptive_limit(a);
+
+	if (a->holdoff) {
+		return;
+	}
+	a->threshold = a->window / 2;
+	if (a->threshold < 1) {
+		a->threshold = 1;
+	}
+	a->window = a->threshold;
+	a->holdoff = old;
+	if (a->debug) {
+		fprintf(stderr, "adaptive: %s, window %d -> %d\n",
+			why, old, adaptive_limit(a));
+	}
+}
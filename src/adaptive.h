@@ -0,0 +1,30 @@
+#ifndef adaptive_h_INCLUDED
+#define adaptive_h_INCLUDED
+
+#include <glib.h>
+
+
+/**
+ * The state of the adaptive window.
+ */
+struct _adaptive {
+	double window;		/* How many hosts we allow at once */
+	double threshold;	/* Slow start until the window gets here */
+	int max;		/* --max-parallel */
+	int holdoff;		/* Responses to go before backing off again */
+	gint64 min_latency;	/* Best response time, usec */
+	gint64 epoch_min;	/* Best response time in this epoch */
+	int epoch_count;
+	int debug;
+};
+typedef struct _adaptive Adaptive;
+
+
+// adaptive.c
+Adaptive *new_adaptive(int start, int max, int debug);
+int adaptive_limit(Adaptive *a);
+void adaptive_latency(Adaptive *a, gint64 usec);
+void adaptive_failure(Adaptive *a);
+
+
+#endif // adaptive_h_INCLUDED
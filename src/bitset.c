@@ -0,0 +1,183 @@
+/*
+ * Sets of hosts, one bit for each host name.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "bitset.h"
+
+
+#define WORD(id) ((id) / 64)
+#define BIT(id) ((guint64) 1 << ((id) % 64))
+
+
+static void grow(Bitset *b, guint32 nwords);
+static void recount(Bitset *b);
+static int count_word(guint64 w);
+static int lowest_bit(guint64 w);
+
+
+Bitset *new_bitset(void)
+{
+	return g_new0(Bitset, 1);
+}
+
+
+void free_bitset(Bitset *b)
+{
+	g_free(b->words);
+	g_free(b);
+}
+
+
+void bitset_add(Bitset *b, HostId id)
+{
+	if (WORD(id) >= b->nwords) {
+		grow(b, MAX(b->nwords * 2, WORD(id) + 1));
+	}
+	if (! (b->words[WORD(id)] & BIT(id))) {
+		b->words[WORD(id)] |= BIT(id);
+		b->count ++;
+	}
+}
+
+
+void bitset_remove(Bitset *b, HostId id)
+{
+	if (bitset_has(b, id)) {
+		b->words[WORD(id)] &= ~BIT(id);
+		b->count --;
+	}
+}
+
+
+int bitset_has(Bitset *b, HostId id)
+{
+	return WORD(id) < b->nwords && (b->words[WORD(id)] & BIT(id));
+}
+
+
+guint32 bitset_count(Bitset *b)
+{
+	return b->count;
+}
+
+
+/**
+ * For going through the hosts in a set, in order of their ids.
+ *
+ * @return the first host in the set at or after from, or NO_HOST
+ */
+HostId bitset_next(Bitset *b, HostId from)
+{
+	guint32 i = WORD(from);
+	guint64 w;
+
+	if (i >= b->nwords) {
+		return NO_HOST;
+	}
+	// Leave out the bits before from in its word.
+	w = b->words[i] & ~(BIT(from) - 1);
+	while (! w) {
+		if (++i >= b->nwords) {
+			return NO_HOST;
+		}
+		w = b->words[i];
+	}
+	return i * 64 + lowest_bit(w);
+}
+
+
+/**
+ * Add the hosts in b to a.
+ */
+void bitset_union(Bitset *a, Bitset *b)
+{
+	if (b->nwords > a->nwords) {
+		grow(a, b->nwords);
+	}
+	for (guint32 i=0; i<b->nwords; i++) {
+		a->words[i] |= b->words[i];
+	}
+	recount(a);
+}
+
+
+/**
+ * Keep only the hosts in a that are also in b.
+ */
+void bitset_intersect(Bitset *a, Bitset *b)
+{
+	guint32 n = MIN(a->nwords, b->nwords);
+
+	for (guint32 i=0; i<n; i++) {
+		a->words[i] &= b->words[i];
+	}
+	if (a->nwords > n) {
+		memset(a->words + n, 0, (a->nwords - n) * sizeof(guint64));
+	}
+	recount(a);
+}
+
+
+/**
+ * Take the hosts in b out of a.
+ */
+void bitset_subtract(Bitset *a, Bitset *b)
+{
+	guint32 n = MIN(a->nwords, b->nwords);
+
+	for (guint32 i=0; i<n; i++) {
+		a->words[i] &= ~b->words[i];
+	}
+	recount(a);
+}
+
+
+static void grow(Bitset *b, guint32 nwords)
+{
+	b->words = g_renew(guint64, b->words, nwords);
+	memset(b->words + b->nwords, 0, (nwords - b->nwords) * sizeof(guint64));
+	b->nwords = nwords;
+}
+
+
+static void recount(Bitset *b)
+{
+	b->count = 0;
+	for (guint32 i=0; i<b->nwords; i++) {
+		b->count += count_word(b->words[i]);
+	}
+}
+
+
+static int count_word(guint64 w)
+{
+#ifdef __GNUC__
+	return __builtin_popcountll(w);
+#else
+	int n = 0;
+	for (; w; w &= w - 1) {
+		n ++;
+	}
+	return n;
+#endif
+}
+
+
+/**
+ * @param w must not be 0
+ */
+static int lowest_bit(guint64 w)
+{
+#ifdef __GNUC__
+	return __builtin_ctzll(w);
+#else
+	int n = 0;
+	for (; ! (w & 1); w >>= 1) {
+		n ++;
+	}
+	return n;
+#endif
+}
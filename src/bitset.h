@@ -0,0 +1,33 @@
+#ifndef bitset_h_INCLUDED
+#define bitset_h_INCLUDED
+
+#include <glib.h>
+
+#include "names.h"
+
+
+/**
+ * A set of hosts, as one bit per HostId.  It grows as higher ids are added.
+ */
+struct _bitset {
+	guint64 *words;
+	guint32 nwords;
+	guint32 count;		/* How many bits are set */
+};
+typedef struct _bitset Bitset;
+
+
+// bitset.c
+Bitset *new_bitset(void);
+void free_bitset(Bitset *b);
+void bitset_add(Bitset *b, HostId id);
+void bitset_remove(Bitset *b, HostId id);
+int bitset_has(Bitset *b, HostId id);
+guint32 bitset_count(Bitset *b);
+HostId bitset_next(Bitset *b, HostId from);
+void bitset_union(Bitset *a, Bitset *b);
+void bitset_intersect(Bitset *a, Bitset *b);
+void bitset_subtract(Bitset *a, Bitset *b);
+
+
+#endif // bitset_h_INCLUDED
@@ -0,0 +1,232 @@
+/*
+ * Keep the number of hosts we run at once inside what the system will give
+ * us.  Each host costs a pty (unless ssh runs on a pipe), a couple of file
+ * descriptors while it starts, and a process or two (ssh, and its
+ * ControlMaster).  We work out at the
+ * start how many hosts that allows, after raising the soft limits as far as
+ * we can, and cut back further if starting a host fails for lack of any of
+ * them.
+ */
+
+#define _DEFAULT_SOURCE		/* RLIMIT_NPROC */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include "budget.h"
+
+
+/** File descriptors each host holds while it starts. */
+#define FDS_PER_HOST 3
+/** Processes each host can have: ssh and its ControlMaster. */
+#define PROCS_PER_HOST 2
+/** Left for everything else. */
+#define FD_RESERVE 16
+#define PROC_RESERVE 16
+#define PTY_RESERVE 8
+
+
+static int raise_limit(int resource, rlim_t *soft);
+static int count_fds(void);
+static int count_procs(void);
+static int read_int(const char *filename);
+static void set_limit(Budget *b, int n, const char *why);
+
+
+/**
+ * Work out how many hosts the system lets us run at once.
+ *
+ * @param no_pty TRUE if ssh runs on a pipe, so the pty limit doesn't matter
+ * @param debug TRUE to report the limits on stderr
+ */
+Budget *new_budget(int no_pty, int debug)
+{
+	Budget *b = g_new0(Budget, 1);
+	rlim_t soft;
+	int max, nr;
+
+	b->limit = G_MAXINT;
+	b->debug = debug;
+	b->why = "nothing";
+
+	if (raise_limit(RLIMIT_NOFILE, &soft)) {
+		int n = ((int) MIN(soft, G_MAXINT) - count_fds() - FD_RESERVE)
+			/ FDS_PER_HOST;
+		set_limit(b, n, "open file limit");
+	}
+	// NPROC counts all our processes, and doesn't apply to root.
+	if (0 != geteuid() && raise_limit(RLIMIT_NPROC, &soft)) {
+		int n = ((int) MIN(soft, G_MAXINT) - count_procs()
+			 - PROC_RESERVE) / PROCS_PER_HOST;
+		set_limit(b, n, "process limit");
+	}
+	max = no_pty ? 0 : read_int("/proc/sys/kernel/pty/max");
+	nr = no_pty ? 0 : read_int("/proc/sys/kernel/pty/nr");
+	if (max > 0 && nr >= 0) {
+		set_limit(b, max - nr - PTY_RESERVE, "pty limit");
+	}
+	if (b->debug) {
+		fprintf(stderr, "budget: %d hosts at once (%s)\n",
+			b->limit, b->why);
+	}
+	return b;
+}
+
+
+/**
+ * How many hosts we can run at once right now.
+ */
+int budget_limit(Budget *b)
+{
+	return b->limit;
+}
+
+
+/**
+ * Starting a host failed for lack of a resource.  We can only run as many
+ * as are running now.
+ *
+ * @param running how many other hosts are running
+ * @param err errno from the failure
+ */
+void budget_exhausted(Budget *b, int running, int err)
+{
+	b->exhausted ++;
+	if (running < b->limit) {
+		set_limit(b, running, strerror(err));
+		if (b->debug) {
+			fprintf(stderr, "budget: %s, now %d hosts at once\n",
+				strerror(err), b->limit);
+		}
+	}
+}
+
+
+/**
+ * Is this errno from running out of something, so that the host can start
+ * once another finishes?
+ */
+int budget_error(int err)
+{
+	return EAGAIN == err || EMFILE == err || ENFILE == err
+		|| ENOSPC == err || ENOMEM == err;
+}
+
+
+/**
+ * Raise a soft limit to the hard limit.
+ *
+ * @param soft where to put the soft limit we ended up with
+ * @return TRUE if there is a limit, FALSE if it is unlimited
+ */
+static int raise_limit(int resource, rlim_t *soft)
+{
+	struct rlimit rl;
+
+	if (-1 == getrlimit(resource, &rl)) {
+		return FALSE;
+	}
+	if (rl.rlim_cur != rl.rlim_max) {
+		rlim_t cur = rl.rlim_cur;
+		rl.rlim_cur = rl.rlim_max;
+		if (-1 == setrlimit(resource, &rl)) {
+			rl.rlim_cur = cur;
+		}
+	}
+	*soft = rl.rlim_cur;
+	return RLIM_INFINITY != rl.rlim_cur;
+}
+
+
+/**
+ * How many file descriptors we have open already.
+ */
+static int count_fds(void)
+{
+	DIR *d = opendir("/proc/self/fd");
+	struct dirent *de;
+	int n = 0;
+
+	if (! d) {
+		return FD_RESERVE;
+	}
+	while ((de = readdir(d))) {
+		if ('.' != de->d_name[0]) {
+			n ++;
+		}
+	}
+	closedir(d);
+	return n;
+}
+
+
+/**
+ * How many processes we have already, which all count against RLIMIT_NPROC.
+ */
+static int count_procs(void)
+{
+	DIR *d = opendir("/proc");
+	struct dirent *de;
+	uid_t uid = getuid();
+	int n = 0;
+
+	if (! d) {
+		return PROC_RESERVE;
+	}
+	while ((de = readdir(d))) {
+		struct stat st;
+		gchar *path;
+
+		if (de->d_name[0] < '0' || de->d_name[0] > '9') {
+			continue;
+		}
+		path = g_strdup_printf("/proc/%s", de->d_name);
+		if (0 == stat(path, &st) && uid == st.st_uid) {
+			n ++;
+		}
+		g_free(path);
+	}
+	closedir(d);
+	return n;
+}
+
+
+/**
+ * Read a number from a file, eg in /proc.
+ *
+ * @return the number, or -1
+ */
+static int read_int(const char *filename)
+{
+	FILE *f = fopen(filename, "r");
+	int n = -1;
+
+	if (f) {
+		if (1 != fscanf(f, "%d", &n)) {
+			n = -1;
+		}
+		fclose(f);
+	}
+	return n;
+}
+
+
+static void set_limit(Budget *b, int n, const char *why)
+{
+	if (n < 1) {
+		n = 1;
+	}
+	if (n < b->limit) {
+		b->limit = n;
+		b->why = why;
+	}
+}
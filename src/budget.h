@@ -0,0 +1,27 @@
+#ifndef budget_h_INCLUDED
+#define budget_h_INCLUDED
+
+#include <glib.h>
+
+
+/**
+ * How many hosts the system's limits let us run at once.
+ */
+struct _budget {
+	int limit;		/* Hosts we can run at once */
+	const char *why;	/* Which resource sets the limit */
+	int throttled;		/* Hosts that waited for the budget */
+	int exhausted;		/* Hosts that failed to start, and waited */
+	int debug;
+};
+typedef struct _budget Budget;
+
+
+// budget.c
+Budget *new_budget(int no_pty, int debug);
+int budget_limit(Budget *b);
+void budget_exhausted(Budget *b, int running, int err);
+int budget_error(int err);
+
+
+#endif // budget_h_INCLUDED
@@ -0,0 +1,66 @@
+#ifndef context_h_INCLUDED
+#define context_h_INCLUDED
+
+#include <glib.h>
+
+#include "adaptive.h"
+#include "bitset.h"
+#include "budget.h"
+#include "groups.h"
+#include "history.h"
+#include "names.h"
+#include "trace.h"
+#include "watch.h"
+
+
+/**
+ * Everything we know about one set of hosts, and how to reach them.  A
+ * program using libforall can have as many of these as it likes.
+ */
+struct _forAll {
+	const char *name;		/* For messages, eg argv[0] */
+	int debug;
+	Names *names;			/* Every host name, stored once */
+	GArray *hosts;			/* HostId, the hosts to run on */
+	GArray *nots;			/* HostId, the hosts not to run on */
+	GPtrArray *host_lists;		/* HostListName* */
+	GPtrArray *not_host_lists;	/* HostListName* */
+	GPtrArray *not_dirs;		/* gchar*, where the -N lists and the
+					   lists they include were found */
+	Groups *groups;			/* Which lists the hosts came from */
+	GArray *status;			/* HostStatus, by HostId */
+	GArray *finished;		/* HostId, in the order they finished */
+	Bitset *succeeded;		/* Hosts that succeeded */
+	Bitset *failed;			/* Hosts that failed */
+	Bitset *skipped;		/* Hosts -N excluded before they started */
+	gint64 started;			/* When the first Runner started */
+	int list_depth;			/* How deep the list files nest */
+	int rereading;			/* check_not_lists() is reading the
+					   -N lists again during the run */
+	int reread_failed;		/* And one of them could not be read */
+	int host_len;			/* From host_len(), or 0 to work out */
+	GString *ssh;			/* The ssh program */
+	GString *user;			/* ssh -l user, or NULL */
+	GPtrArray *ssh_options;		/* GString*, each added with -o */
+	int mux_all;			/* Share connections for every ssh */
+	int no_pty;			/* Run ssh on a pipe, not a pty */
+	int use_poll;			/* Wait with poll(), not epoll */
+	GString *mux_persist;		/* "ControlPersist=..." for SSH_MUX */
+	GHashTable *list_cache;		/* Absolute pathname to ListFile* */
+	Adaptive *adaptive;		/* Or NULL for a fixed number of hosts */
+	Budget *budget;			/* What the system lets us run */
+	History *history;		/* How long hosts took, or NULL */
+	Trace *trace;			/* Events for --trace, or NULL */
+	ListWatch *watch;		/* The -N lists, if they are watched */
+	int retries;			/* Times to retry an ssh failure */
+	int retry_backoff;		/* First retry delay, ms */
+	int timeout;			/* Longest a step can run, ms, or 0 */
+	gint64 max_output;		/* Most output to keep per step, or 0 */
+	int keep;			/* KEEP_HEAD etc, which of it to keep */
+	gint64 output_bytes;		/* Output read from all the hosts */
+	int peak_running;		/* Most hosts that ran at once */
+};
+typedef struct _forAll ForAll;
+
+
+#endif // context_h_INCLUDED
@@ -0,0 +1,934 @@
+/*
+ * for-all --daemon, and the client side of it.
+ *
+ * The daemon listens on a Unix socket.  A client sends its current
+ * directory, arguments and environment, and passes its stdin, stdout and
+ * stderr along with them.  The daemon forks a worker for each job, which
+ * carries on through main() as if it had been started with those arguments,
+ * and the worker's exit status goes back to the client.
+ *
+ * What the daemon saves is the list files, and the ssh connections, which
+ * workers share through ControlMaster and which stay up between jobs.  The
+ * lists are kept parsed.  Those in the list directories are read at the
+ * start, and those a job names in its own directory as it comes in, and
+ * each is read again when inotify says it has changed.
+ */
+
+#define _GNU_SOURCE		/* accept4(), getcwd(NULL, 0) */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <sys/inotify.h>
+
+#include "for-all.h"
+#include "daemon.h"
+#include "libforall.h"
+#include "lists.h"
+
+
+/** How long the daemon keeps an idle ssh connection, in seconds. */
+#define DAEMON_PERSIST 600
+
+/** How long we wait for a client to send its job, in seconds. */
+#define REQUEST_TIMEOUT 5
+
+/** The most we'll take in one job, in bytes. */
+#define REQUEST_MAX (1024 * 1024)
+
+
+/**
+ * One job, running in a worker.
+ */
+struct _daemonJob {
+	pid_t pid;
+	int conn;		/* To the client, or -1 if it went away */
+};
+typedef struct _daemonJob DaemonJob;
+
+
+/**
+ * A client's job while it is still arriving.  We read it a piece at a time
+ * from the poll loop, so one slow client doesn't hold up everyone else.
+ */
+struct _daemonRequest {
+	int conn;
+	int fds[3];		/* Its stdin, stdout and stderr, once we have them */
+	guint32 len;		/* Of the request, once we have the fds */
+	guint32 got;		/* How much of the request we have */
+	GString *req;
+	gint64 deadline;	/* When we give up on it */
+};
+typedef struct _daemonRequest DaemonRequest;
+
+
+static gchar *socket_path(void);
+static int listen_socket(const char *path);
+static void watch_lists(void);
+static void watch_dir(const char *dir);
+static ListFile *load_list(const char *pathname);
+static void warm_lists(const char *cwd, int nargs, char **args);
+static void warm_list(const char *cwd, const char *name, int depth);
+static void list_events(void);
+static DaemonRequest *new_request(int conn);
+static int read_request(DaemonRequest *dr);
+static int request_timeout(void);
+static void drop_request(DaemonRequest *dr);
+static int start_job(DaemonRequest *dr, int *argc, char ***argv);
+static void reap_jobs(void);
+static void end_job(DaemonJob *job, int code);
+static void on_sigchld(int sig);
+static void free_list(gpointer p);
+static int write_full(int fd, const void *buf, size_t len);
+static int read_full(int fd, void *buf, size_t len);
+
+
+/** Set in a worker, which uses the daemon's lists and connections. */
+static int worker = 0;
+
+/** ListFile* by absolute pathname. */
+static GHashTable *list_cache = 0;
+
+/** Just for parsing the lists with. */
+static ForAll *parser = 0;
+
+/** Where every list is read from, from list_dirs(). */
+static gchar **etc_dirs = 0;
+
+/** inotify watch descriptor to directory name. */
+static GHashTable *watches = 0;
+
+static int inotify_fd = -1;
+static int listen_fd = -1;
+
+/** SIGCHLD writes here so poll() wakes up. */
+static int child_pipe[2] = { -1, -1 };
+
+/** DaemonJob* */
+static GPtrArray *jobs = 0;
+
+/** DaemonRequest*, oldest first. */
+static GPtrArray *requests = 0;
+
+
+/**
+ * Does the command line ask for the daemon?  We look before do_opts(), as
+ * the daemon doesn't want any of the other work done.
+ */
+int daemon_wanted(int argc, char **argv)
+{
+	for (int i=1; i<argc && strcmp(argv[i], "--"); i++) {
+		if (0 == strcmp(argv[i], "--daemon")) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+/**
+ * Run the job in the daemon, if there is one.
+ *
+ * @param status where to put our exit status, if the daemon ran the job
+ * @return TRUE if the daemon ran the job, FALSE if we should run it ourselves
+ */
+int daemon_client(int argc, char **argv, int *status)
+{
+	extern char **environ;
+	struct sockaddr_un sa;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union {
+		char buf[CMSG_SPACE(3 * sizeof(int))];
+		struct cmsghdr align;
+	} control;
+	int fds[3] = { 0, 1, 2 };
+	guint32 len;
+	gchar *path;
+	GString *req;
+	char *cwd;
+	int envc = 0;
+	int s;
+	int code;
+
+	for (int i=1; i<argc && strcmp(argv[i], "--"); i++) {
+		if (0 == strcmp(argv[i], "--no-daemon")) {
+			return FALSE;
+		}
+	}
+	path = socket_path();
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		g_free(path);
+		return FALSE;
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+	g_free(path);
+	s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (-1 == s) {
+		return FALSE;
+	}
+	if (-1 == connect(s, (struct sockaddr *) &sa, sizeof(sa))) {
+		// No daemon, which is the usual case.
+		close(s);
+		return FALSE;
+	}
+
+	// The request is NUL terminated words: the directory, the number of
+	// arguments and the arguments, then the same for the environment.
+	req = g_string_new("");
+	cwd = getcwd(NULL, 0);
+	g_string_append_len(req, cwd ? cwd : "/", strlen(cwd ? cwd : "/") + 1);
+	free(cwd);
+	g_string_append_printf(req, "%d", argc);
+	g_string_append_c(req, '\0');
+	for (int i=0; i<argc; i++) {
+		g_string_append_len(req, argv[i], strlen(argv[i]) + 1);
+	}
+	while (environ[envc]) {
+		envc ++;
+	}
+	g_string_append_printf(req, "%d", envc);
+	g_string_append_c(req, '\0');
+	for (int i=0; i<envc; i++) {
+		g_string_append_len(req, environ[i], strlen(environ[i]) + 1);
+	}
+
+	// The length goes first, with our stdin, stdout and stderr.
+	len = req->len;
+	iov.iov_base = &len;
+	iov.iov_len = sizeof(len);
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+	if (-1 == sendmsg(s, &msg, 0)
+	    || -1 == write_full(s, req->str, req->len)) {
+		fprintf(stderr, "%s: Cannot send to the daemon: %s\n",
+			myname, strerror(errno));
+		exit(5);
+	}
+	g_string_free(req, TRUE);
+
+	// If we're killed, the daemon sees the socket close and stops the job.
+	if (-1 == read_full(s, &code, sizeof(code))) {
+		fprintf(stderr, "%s: Lost the daemon\n", myname);
+		exit(5);
+	}
+	close(s);
+	*status = code;
+	return TRUE;
+}
+
+
+/**
+ * Be the daemon.  This only returns in a worker, with argc and argv changed
+ * to the job's.
+ */
+void serve_jobs(int *argc, char ***argv)
+{
+	gchar *path;
+	struct sigaction sa;
+
+	if (2 != *argc) {
+		fprintf(stderr, "%s: --daemon takes no other arguments\n",
+			myname);
+		exit(1);
+	}
+	path = socket_path();
+	listen_fd = listen_socket(path);
+	watch_lists();
+	jobs = g_ptr_array_new();
+	requests = g_ptr_array_new();
+
+	if (-1 == pipe(child_pipe)) {
+		fprintf(stderr, "%s: pipe: %s\n", myname, strerror(errno));
+		exit(5);
+	}
+	for (int i=0; i<2; i++) {
+		fcntl(child_pipe[i], F_SETFL, O_NONBLOCK);
+		fcntl(child_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = on_sigchld;
+	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+	sigaction(SIGCHLD, &sa, 0);
+	// A client that has gone away must not kill us.
+	signal(SIGPIPE, SIG_IGN);
+
+	fprintf(stderr, "%s: listening on %s\n", myname, path);
+	g_free(path);
+
+	while (1) {
+		int nreqs = requests->len;
+		int njobs = jobs->len;
+		int nfds = 3 + nreqs + njobs;
+		struct pollfd fds[nfds];
+		gint64 now;
+
+		fds[0].fd = listen_fd;
+		fds[1].fd = inotify_fd;
+		fds[2].fd = child_pipe[0];
+		for (int i=0; i<nreqs; i++) {
+			DaemonRequest *dr = g_ptr_array_index(requests, i);
+			fds[3+i].fd = dr->conn;
+		}
+		for (int i=0; i<njobs; i++) {
+			DaemonJob *job = g_ptr_array_index(jobs, i);
+			fds[3+nreqs+i].fd = job->conn;
+		}
+		for (int i=0; i<nfds; i++) {
+			fds[i].events = POLLIN;
+			fds[i].revents = 0;
+		}
+		if (-1 == poll(fds, nfds, request_timeout())) {
+			if (EINTR == errno) {
+				continue;
+			}
+			fprintf(stderr, "%s: poll: %s\n", myname, strerror(errno));
+			exit(5);
+		}
+
+		// The client sends nothing after its request, so anything
+		// here means it has gone, and so should its job.  This must
+		// come before reap_jobs(), which takes jobs out of the array
+		// that fds follows.
+		for (int i=0; i<njobs; i++) {
+			DaemonJob *job = g_ptr_array_index(jobs, i);
+			if (fds[3+nreqs+i].revents && -1 != job->conn) {
+				kill(job->pid, SIGTERM);
+				close(job->conn);
+				job->conn = -1;
+			}
+		}
+		if (fds[2].revents) {
+			char buf[64];
+			while (read(child_pipe[0], buf, sizeof(buf)) > 0)
+				;
+			reap_jobs();
+		}
+		if (fds[1].revents) {
+			list_events();
+		}
+		// Backwards, so taking one out doesn't move those still to do.
+		now = g_get_monotonic_time();
+		for (int i=nreqs-1; i>=0; i--) {
+			DaemonRequest *dr = g_ptr_array_index(requests, i);
+			int got = fds[3+i].revents ? read_request(dr) : 0;
+
+			if (0 == got && now < dr->deadline) {
+				continue;
+			}
+			g_ptr_array_remove_index(requests, i);
+			if (got > 0) {
+				if (start_job(dr, argc, argv)) {
+					// We're the worker.
+					return;
+				}
+			} else {
+				drop_request(dr);
+			}
+		}
+		if (fds[0].revents) {
+			int conn = accept4(listen_fd, 0, 0,
+					   SOCK_CLOEXEC | SOCK_NONBLOCK);
+			if (-1 != conn) {
+				g_ptr_array_add(requests, new_request(conn));
+			}
+		}
+	}
+}
+
+
+/**
+ * Set up a worker's context to use what the daemon keeps.  Does nothing
+ * outside a worker.
+ */
+void daemon_context(ForAll *fa)
+{
+	if (! worker) {
+		return;
+	}
+	fa->list_cache = list_cache;
+	fa->mux_all = TRUE;
+	g_string_printf(fa->mux_persist, "ControlPersist=%d", DAEMON_PERSIST);
+}
+
+
+/**
+ * $FOR_ALL_SOCKET, or for-all.sock in the user's runtime directory.
+ *
+ * @return a new string
+ */
+static gchar *socket_path(void)
+{
+	const char *env = getenv("FOR_ALL_SOCKET");
+
+	if (env && *env) {
+		return g_strdup(env);
+	}
+	return g_strdup_printf("%s/for-all.sock", g_get_user_runtime_dir());
+}
+
+
+static int listen_socket(const char *path)
+{
+	struct sockaddr_un sa;
+	mode_t mask;
+	int s;
+
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		fprintf(stderr, "%s: Socket name too long: %s\n", myname, path);
+		exit(3);
+	}
+	memset(&sa, 0, sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	s = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (-1 == s) {
+		fprintf(stderr, "%s: socket: %s\n", myname, strerror(errno));
+		exit(5);
+	}
+	// Anyone who can connect can run commands as us.
+	unlink(path);
+	mask = umask(077);
+	if (-1 == bind(s, (struct sockaddr *) &sa, sizeof(sa))) {
+		fprintf(stderr, "%s: Cannot bind %s: %s\n",
+			myname, path, strerror(errno));
+		exit(3);
+	}
+	umask(mask);
+	if (-1 == listen(s, 64)) {
+		fprintf(stderr, "%s: listen: %s\n", myname, strerror(errno));
+		exit(5);
+	}
+	return s;
+}
+
+
+/**
+ * Read every list file in the list directories, and watch the directories
+ * for changes.  Watching the directories rather than the files catches
+ * editors that write a new file and rename it into place.
+ */
+static void watch_lists(void)
+{
+	parser = new_forall(myname);
+	etc_dirs = list_dirs();
+	list_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+					   g_free, free_list);
+	watches = g_hash_table_new_full(g_direct_hash, g_direct_equal, 0, g_free);
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (-1 == inotify_fd) {
+		fprintf(stderr, "%s: inotify: %s\n", myname, strerror(errno));
+		exit(5);
+	}
+	for (int i=0; etc_dirs[i]; i++) {
+		DIR *d = opendir(etc_dirs[i]);
+		struct dirent *de;
+
+		if (! d) {
+			// No such directory, so nothing to keep.
+			continue;
+		}
+		watch_dir(etc_dirs[i]);
+		while ((de = readdir(d))) {
+			if ('.' != de->d_name[0]) {
+				gchar *p = g_build_filename(etc_dirs[i],
+							    de->d_name, NULL);
+				load_list(p);
+				g_free(p);
+			}
+		}
+		closedir(d);
+	}
+}
+
+
+static void watch_dir(const char *dir)
+{
+	int wd = inotify_add_watch(inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO
+				   | IN_MOVED_FROM | IN_DELETE);
+
+	// The same directory gets the same wd, so this never adds twice.
+	if (-1 != wd) {
+		g_hash_table_insert(watches, GINT_TO_POINTER(wd),
+				    g_strdup(dir));
+	}
+}
+
+
+/**
+ * Read one list file into the cache, or drop it from the cache if it has
+ * gone.
+ *
+ * @return the list, or NULL if it has gone
+ */
+static ListFile *load_list(const char *pathname)
+{
+	ListFile *lf;
+	struct stat st;
+
+	g_hash_table_remove(list_cache, pathname);
+	if (-1 == stat(pathname, &st) || ! S_ISREG(st.st_mode)) {
+		return 0;
+	}
+	lf = read_list_file(parser, pathname);
+	if (lf) {
+		g_hash_table_insert(list_cache, g_strdup(pathname), lf);
+	}
+	return lf;
+}
+
+
+/**
+ * Make sure we have the lists a job names, and those they include, before
+ * its worker goes looking.  Lists in the job's directory are only found
+ * here.  We only look for the usual ways of naming lists; the worker reads
+ * any we miss for itself.
+ *
+ * @param cwd the job's directory
+ */
+static void warm_lists(const char *cwd, int nargs, char **args)
+{
+	const char *opts[] = {
+		"-H", "--host-list", "-N", "--not-list", "-E", "--expr", NULL
+	};
+
+	warm_list(cwd, "all", 0);
+	for (int i=1; i<nargs && strcmp(args[i], "--"); i++) {
+		const char *value = 0;
+		int expr = FALSE;
+
+		for (int j=0; opts[j] && ! value; j++) {
+			int len = strlen(opts[j]);
+			if (strncmp(args[i], opts[j], len)) {
+				continue;
+			}
+			if (! args[i][len] && i + 1 < nargs) {
+				value = args[i + 1];
+			} else if (2 == len || '=' == args[i][len]) {
+				// -Hname, or --host-list=name
+				value = args[i] + len + ('=' == args[i][len]);
+			}
+			expr = j >= 4;
+		}
+		if (! value || ! *value) {
+			continue;
+		}
+		if (expr) {
+			// The lists are the words of the expression.
+			gchar **words = g_strsplit_set(value, " \t()|&", -1);
+			for (int j=0; words[j]; j++) {
+				if (*words[j]) {
+					warm_list(cwd, words[j], 0);
+				}
+			}
+			g_strfreev(words);
+		} else {
+			warm_list(cwd, value, 0);
+		}
+	}
+}
+
+
+/**
+ * Find a list the way open_file_list() does, reading it into the cache if
+ * it's in the job's directory and we don't have it yet, then the same for
+ * the lists it includes.
+ */
+static void warm_list(const char *cwd, const char *name, int depth)
+{
+	gchar *path;
+	ListFile *lf;
+
+	// Deeper than read_one_list() allows.
+	if (depth >= 5) {
+		return;
+	}
+	path = g_path_is_absolute(name) ? g_strdup(name)
+		: g_build_filename(cwd, name, NULL);
+	lf = g_hash_table_lookup(list_cache, path);
+	if (! lf && (lf = load_list(path))) {
+		gchar *dir = g_path_get_dirname(path);
+		watch_dir(dir);
+		g_free(dir);
+	}
+	g_free(path);
+	for (int i=0; ! lf && ! strchr(name, '/') && etc_dirs[i]; i++) {
+		path = g_build_filename(etc_dirs[i], name, NULL);
+		lf = g_hash_table_lookup(list_cache, path);
+		g_free(path);
+	}
+	for (int i=0; lf && i<lf->includes->len; i++) {
+		warm_list(cwd, g_ptr_array_index(lf->includes, i), depth + 1);
+	}
+}
+
+
+/**
+ * Re-read the list files that inotify says have changed.
+ */
+static void list_events(void)
+{
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+	ssize_t n;
+
+	while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+		char *p = buf;
+		while (p < buf + n) {
+			struct inotify_event *ev = (struct inotify_event *) p;
+			const char *dir = g_hash_table_lookup(
+				watches, GINT_TO_POINTER(ev->wd));
+			p += sizeof(struct inotify_event) + ev->len;
+			if (ev->mask & IN_IGNORED) {
+				g_hash_table_remove(watches,
+						    GINT_TO_POINTER(ev->wd));
+				continue;
+			}
+			if (dir && ev->len) {
+				gchar *path = g_build_filename(dir, ev->name,
+							       NULL);
+				// Not every file in a job's directory is a
+				// list.
+				if (g_strv_contains((const gchar * const *)
+						    etc_dirs, dir)
+				    || g_hash_table_contains(list_cache, path)) {
+					load_list(path);
+				}
+				g_free(path);
+			}
+		}
+	}
+}
+
+
+static DaemonRequest *new_request(int conn)
+{
+	DaemonRequest *dr = g_new0(DaemonRequest, 1);
+
+	dr->conn = conn;
+	for (int i=0; i<3; i++) {
+		dr->fds[i] = -1;
+	}
+	dr->req = g_string_new("");
+	dr->deadline = g_get_monotonic_time()
+		+ REQUEST_TIMEOUT * G_USEC_PER_SEC;
+	return dr;
+}
+
+
+/**
+ * Read what has arrived of a request: the length and file descriptors
+ * first, then the request itself.  The connection doesn't block.
+ *
+ * @return 1 if we have it all, 0 if there's more to come, -1 if it's bad
+ */
+static int read_request(DaemonRequest *dr)
+{
+	ssize_t n;
+
+	if (-1 == dr->fds[0]) {
+		struct msghdr msg;
+		struct iovec iov;
+		struct cmsghdr *cmsg;
+		union {
+			char buf[CMSG_SPACE(3 * sizeof(int))];
+			struct cmsghdr align;
+		} control;
+		guint32 len;
+
+		iov.iov_base = &len;
+		iov.iov_len = sizeof(len);
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+		n = recvmsg(dr->conn, &msg, MSG_CMSG_CLOEXEC);
+		if (-1 == n && (EAGAIN == errno || EINTR == errno)) {
+			return 0;
+		}
+		// The client sends the length in one go, so we get it whole.
+		if (sizeof(len) != n) {
+			return -1;
+		}
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (! cmsg || SOL_SOCKET != cmsg->cmsg_level
+		    || SCM_RIGHTS != cmsg->cmsg_type
+		    || CMSG_LEN(3 * sizeof(int)) != cmsg->cmsg_len) {
+			return -1;
+		}
+		memcpy(dr->fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+		if (0 == len || len > REQUEST_MAX) {
+			return -1;
+		}
+		dr->len = len;
+		g_string_set_size(dr->req, len);
+	}
+	while (dr->got < dr->len) {
+		n = read(dr->conn, dr->req->str + dr->got, dr->len - dr->got);
+		if (-1 == n && (EAGAIN == errno || EINTR == errno)) {
+			return 0;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		dr->got += n;
+	}
+	// Each word must be terminated.
+	return '\0' == dr->req->str[dr->len-1] ? 1 : -1;
+}
+
+
+/**
+ * How long poll() may wait before the oldest request runs out of time.
+ *
+ * @return milliseconds, or -1 for as long as it likes
+ */
+static int request_timeout(void)
+{
+	gint64 wait;
+
+	if (! requests->len) {
+		return -1;
+	}
+	wait = ((DaemonRequest *) g_ptr_array_index(requests, 0))->deadline
+		- g_get_monotonic_time();
+	return wait > 0 ? (wait + 999) / 1000 : 0;
+}
+
+
+/**
+ * Turn a request away, and free it.
+ */
+static void drop_request(DaemonRequest *dr)
+{
+	int code = 5;
+
+	for (int i=0; i<3; i++) {
+		if (-1 != dr->fds[i]) {
+			close(dr->fds[i]);
+		}
+	}
+	write_full(dr->conn, &code, sizeof(code));
+	close(dr->conn);
+	g_string_free(dr->req, TRUE);
+	g_free(dr);
+}
+
+
+/**
+ * Fork a worker for a request we have all of.  The request is used up
+ * either way.
+ *
+ * @return TRUE in the worker, FALSE in the daemon
+ */
+static int start_job(DaemonRequest *dr, int *argc, char ***argv)
+{
+	extern char **environ;
+	GString *req = dr->req;
+	GPtrArray *words = g_ptr_array_new();
+	int nargs, nenv;
+	DaemonJob *job;
+	pid_t pid;
+
+	for (char *p = req->str; p < req->str + req->len; p += strlen(p) + 1) {
+		g_ptr_array_add(words, p);
+	}
+	// cwd, nargs, args..., nenv, env...
+	if (words->len < 2) {
+		goto fail;
+	}
+	nargs = atoi(g_ptr_array_index(words, 1));
+	if (nargs < 1 || words->len < 3 + nargs) {
+		goto fail;
+	}
+	nenv = atoi(g_ptr_array_index(words, 2 + nargs));
+	if (nenv < 0 || words->len != 3 + nargs + nenv) {
+		goto fail;
+	}
+	warm_lists(g_ptr_array_index(words, 0), nargs,
+		   (char **) words->pdata + 2);
+
+	fflush(stdout);
+	fflush(stderr);
+	pid = fork();
+	if (-1 == pid) {
+		goto fail;
+	}
+	if (0 == pid) {
+		char **env = g_new0(char *, nenv + 1);
+		char **args = g_new0(char *, nargs + 1);
+
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGPIPE, SIG_DFL);
+		close(listen_fd);
+		close(inotify_fd);
+		close(child_pipe[0]);
+		close(child_pipe[1]);
+		for (int i=0; i<jobs->len; i++) {
+			DaemonJob *other = g_ptr_array_index(jobs, i);
+			if (-1 != other->conn) {
+				close(other->conn);
+			}
+		}
+		for (int i=0; i<requests->len; i++) {
+			DaemonRequest *other = g_ptr_array_index(requests, i);
+			for (int j=0; j<3; j++) {
+				if (-1 != other->fds[j]) {
+					close(other->fds[j]);
+				}
+			}
+			close(other->conn);
+		}
+		close(dr->conn);
+		for (int i=0; i<3; i++) {
+			dup2(dr->fds[i], i);
+			close(dr->fds[i]);
+		}
+		memcpy(args, words->pdata + 2, nargs * sizeof(char *));
+		memcpy(env, words->pdata + 3 + nargs, nenv * sizeof(char *));
+		environ = env;
+		if (-1 == chdir(g_ptr_array_index(words, 0))) {
+			fprintf(stderr, "%s: Cannot change to %s: %s\n", myname,
+				(char *) g_ptr_array_index(words, 0),
+				strerror(errno));
+			exit(3);
+		}
+		worker = TRUE;
+		*argc = nargs;
+		*argv = args;
+		return TRUE;
+	}
+
+	for (int i=0; i<3; i++) {
+		close(dr->fds[i]);
+	}
+	job = g_new0(DaemonJob, 1);
+	job->pid = pid;
+	job->conn = dr->conn;
+	g_ptr_array_add(jobs, job);
+	g_ptr_array_free(words, TRUE);
+	g_string_free(req, TRUE);
+	g_free(dr);
+	return FALSE;
+
+ fail:
+	g_ptr_array_free(words, TRUE);
+	drop_request(dr);
+	return FALSE;
+}
+
+
+/**
+ * Tell the clients of finished workers how they went.
+ */
+static void reap_jobs(void)
+{
+	pid_t pid;
+	int wstatus;
+
+	while ((pid = waitpid(-1, &wstatus, WNOHANG)) > 0) {
+		for (int i=0; i<jobs->len; i++) {
+			DaemonJob *job = g_ptr_array_index(jobs, i);
+			if (pid != job->pid) {
+				continue;
+			}
+			if (WIFEXITED(wstatus)) {
+				end_job(job, WEXITSTATUS(wstatus));
+			} else {
+				end_job(job, 128 + WTERMSIG(wstatus));
+			}
+			g_ptr_array_remove_index(jobs, i);
+			break;
+		}
+	}
+}
+
+
+static void end_job(DaemonJob *job, int code)
+{
+	if (-1 != job->conn) {
+		write_full(job->conn, &code, sizeof(code));
+		close(job->conn);
+	}
+	g_free(job);
+}
+
+
+static void on_sigchld(int sig)
+{
+	int err = errno;
+
+	if (-1 == write(child_pipe[1], "", 1)) {
+		// Full, so poll() will wake anyway.
+	}
+	errno = err;
+}
+
+
+static void free_list(gpointer p)
+{
+	free_list_file((ListFile *) p);
+}
+
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+
+	while (len) {
+		ssize_t n = write(fd, p, len);
+		if (-1 == n) {
+			if (EINTR == errno) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
+
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = buf;
+
+	while (len) {
+		ssize_t n = read(fd, p, len);
+		if (-1 == n && EINTR == errno) {
+			continue;
+		}
+		if (n <= 0) {
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef daemon_h_INCLUDED
+#define daemon_h_INCLUDED
+
+#include "context.h"
+
+
+// daemon.c
+int daemon_wanted(int argc, char **argv);
+int daemon_client(int argc, char **argv, int *status);
+void serve_jobs(int *argc, char ***argv);
+void daemon_context(ForAll *fa);
+
+
+#endif // daemon_h_INCLUDED
@@ -0,0 +1,177 @@
+/*
+ * Host list expressions, for -E.  Each list named in the expression is read
+ * into a Bitset, and the sets are combined a word at a time, so picking hosts
+ * out of a big fleet this way costs next to nothing:
+ *
+ *   a | b   hosts in either list
+ *   a & b   hosts in both lists
+ *   a - b   hosts in a that are not in b
+ *
+ * & goes before | and -, which go left to right, and brackets group.  A list
+ * is named as it would be after a "+" in a list file.  A - inside a name is
+ * part of it, so "web-eu" is one list, and "web - eu" is a difference.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "expr.h"
+#include "lists.h"
+
+
+struct _exprParser {
+	ForAll *fa;
+	const char *expr;
+	const char *p;		/* How far we have got in expr */
+};
+typedef struct _exprParser ExprParser;
+
+
+static Bitset *parse_union(ExprParser *ep);
+static Bitset *parse_intersection(ExprParser *ep);
+static Bitset *parse_operand(ExprParser *ep);
+static char peek(ExprParser *ep);
+static int is_name_char(char c);
+static void expr_error(ExprParser *ep, const char *what);
+
+
+/**
+ * Work out which hosts an expression picks.  A mistake in the expression is
+ * reported on stderr.
+ *
+ * @return a new Bitset, or NULL if the expression is wrong
+ */
+Bitset *list_expr(ForAll *fa, const char *expr)
+{
+	ExprParser ep = { fa, expr, expr };
+	Bitset *set = parse_union(&ep);
+
+	if (set && peek(&ep)) {
+		expr_error(&ep, "expected &, | or -");
+		free_bitset(set);
+		set = 0;
+	}
+	return set;
+}
+
+
+/**
+ * a | b - c ...
+ */
+static Bitset *parse_union(ExprParser *ep)
+{
+	Bitset *set = parse_intersection(ep);
+
+	while (set && ('|' == peek(ep) || '-' == peek(ep))) {
+		char op = *ep->p++;
+		Bitset *other = parse_intersection(ep);
+		if (! other) {
+			free_bitset(set);
+			return 0;
+		}
+		if ('|' == op) {
+			bitset_union(set, other);
+		} else {
+			bitset_subtract(set, other);
+		}
+		free_bitset(other);
+	}
+	return set;
+}
+
+
+/**
+ * a & b & c ...
+ */
+static Bitset *parse_intersection(ExprParser *ep)
+{
+	Bitset *set = parse_operand(ep);
+
+	while (set && '&' == peek(ep)) {
+		Bitset *other;
+		ep->p ++;
+		other = parse_operand(ep);
+		if (! other) {
+			free_bitset(set);
+			return 0;
+		}
+		bitset_intersect(set, other);
+		free_bitset(other);
+	}
+	return set;
+}
+
+
+/**
+ * A list name, or an expression in brackets.
+ */
+static Bitset *parse_operand(ExprParser *ep)
+{
+	const char *start;
+	gchar *name;
+	Bitset *set;
+
+	if ('(' == peek(ep)) {
+		ep->p ++;
+		set = parse_union(ep);
+		if (! set) {
+			return 0;
+		}
+		if (')' != peek(ep)) {
+			expr_error(ep, "expected )");
+			free_bitset(set);
+			return 0;
+		}
+		ep->p ++;
+		return set;
+	}
+	start = ep->p;
+	// A name can't start with -, as that is the operator.
+	while (is_name_char(*ep->p) && (ep->p > start || '-' != *ep->p)) {
+		ep->p ++;
+	}
+	if (ep->p == start) {
+		expr_error(ep, "expected a list name");
+		return 0;
+	}
+	name = g_strndup(start, ep->p - start);
+	set = read_list_set(ep->fa, name);
+	g_free(name);
+	return set;
+}
+
+
+/**
+ * Skip spaces.
+ *
+ * @return the next character, or '\0' at the end
+ */
+static char peek(ExprParser *ep)
+{
+	while (g_ascii_isspace(*ep->p)) {
+		ep->p ++;
+	}
+	return *ep->p;
+}
+
+
+/**
+ * The same characters that a "+" line in a list file allows.
+ */
+static int is_name_char(char c)
+{
+	return g_ascii_isalnum(c) || (c && strchr("/._-", c));
+}
+
+
+static void expr_error(ExprParser *ep, const char *what)
+{
+	if (*ep->p) {
+		fprintf(stderr, "%s: %s in \"%s\", at \"%s\"\n", ep->fa->name,
+			what, ep->expr, ep->p);
+	} else {
+		fprintf(stderr, "%s: %s at the end of \"%s\"\n", ep->fa->name,
+			what, ep->expr);
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef expr_h_INCLUDED
+#define expr_h_INCLUDED
+
+#include <glib.h>
+
+#include "bitset.h"
+#include "context.h"
+
+
+// expr.c
+Bitset *list_expr(ForAll *fa, const char *expr);
+
+
+#endif // expr_h_INCLUDED
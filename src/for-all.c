@@ -2,6 +2,8 @@
  * Run a command on a list of hosts.
  */
 
+#define _GNU_SOURCE		/* getline() */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -9,12 +11,19 @@
 #include <string.h> // strerror
 #include <assert.h> // strerror
 #include <errno.h>
+#include <ctype.h>
 #include <glib.h>
 
 #include "for-all.h"
 #include "options.h"
-#include "lists.h"
-#include "run-command.h"
+#include "daemon.h"
+#include "expr.h"
+#include "jobs.h"
+#include "libforall.h"
+#include "metrics.h"
+#include "output.h"
+#include "pool.h"
+#include "transfer.h"
 #include "utils.h"
 
 #define DD(n) if(opt_debug >= n)
@@ -24,12 +33,36 @@
 
 const char *myname;
 
+/** The hosts, and how to reach them. */
+static ForAll *fa = 0;
+
 static void debug_print_flags(void);
 static void init(void);
 static void do_opts(int argc, char **argv);
 static void usage(int longusage, int ret);
-static void do_host(int i);
+static GArray *host_order(void);
+static gint compare_slowest(gconstpointer a, gconstpointer b, gpointer data);
+static void run_all(int parallel, RunOps *ops, void *data);
+static int between_rounds(void);
+static int write_host_files(int final);
+static void read_stdin_hosts(void);
+static void set_group_limits(void);
+static void stdin_hosts(Runner *r, void *data);
+static void stdin_line(Runner *r, char *line);
+static void load_script(void);
+static void add_command_word(Template *t, const char *word);
+static int command_step(HostRun *hr, void *data);
+static int script_step(HostRun *hr, void *data);
+static int jobs_step(HostRun *hr, void *data);
+static int start_command(HostRun *hr, Template *args, const char *command);
+static void record_host(HostRun *hr);
+static void command_output(HostRun *hr, const char *buf, int len, void *data);
+static void command_done(HostRun *hr, void *data);
+static void transfer_host_done(HostRun *hr, void *data);
 static void print_s_f_lists(void);
+static void print_skipped(void);
+static void print_results(Bitset *which);
+static void report_budget(int parallel);
 static void list_hosts(void);
 static void list_files(void);
 
@@ -41,30 +74,126 @@ static int         opt_list_only = 0;	   /* -L, --list-only */
 static int         opt_single = 0;	   /* -1, --single */
 static int         opt_reverse = 0;	   /* -r, --reverse */
 static int         opt_sort = 0;	   /* -s, --sort */
-static GPtrArray * opt_ssh_options = 0;	   /* -o, --ssh-option */
-static GString *   opt_ssh_program = 0;	   /* -S, --ssh-program */
 static int         opt_no_tty = 0;	   /* -T, --no-tty */
-static GString *   opt_user = 0;	   /* -u, --user */
+static int         opt_parallel = 0;	   /* -P, --parallel */
+static int         opt_prefix = 0;	   /* --prefix */
+static int         opt_adaptive = 0;	   /* --adaptive */
+static int         opt_max_parallel = 0;   /* --max-parallel */
+static int         opt_threads = 1;	   /* --threads */
+static GPtrArray * opt_group_limits = 0;   /* --group-limit, name=n */
+static int         opt_per_list_limit = 0; /* --per-list-limit */
+static GString *   opt_push = 0;	   /* --push local remote */
+static GString *   opt_pull = 0;	   /* --pull remote local */
+static GString *   opt_transfer_to = 0;	   /* Second arg of --push or --pull */
+static int         opt_slowest_first = 0;  /* --order=slowest-first */
+static int         opt_shard = 0;	   /* --shard i/N */
+static int         opt_nshards = 0;
+static const char *opt_write_failed = 0;   /* --write-failed */
+static const char *opt_write_succeeded = 0; /* --write-succeeded */
+static const char *opt_trace = 0;	   /* --trace */
+static const char *opt_metrics_file = 0;   /* --metrics-file */
+static int         opt_stdin_hosts = 0;   /* -H - */
+static int         opt_expr = 0;	   /* -E */
+static const char *opt_script = 0;	   /* --script */
+static const char *opt_jobs = 0;	   /* --jobs */
+static int         opt_template = 0;	   /* --template */
 static GPtrArray * opt_command = 0;	   /* Remote command */
+static Template *  command_args = 0;	   /* ssh and the remote command */
+static GPtrArray * script_args = 0;	   /* Template*, ssh and each step */
+static Jobs *      jobs = 0;		   /* --jobs, each host's commands */
+static Template *  jobs_args = 0;	   /* ssh for --jobs */
+static int         skipped_shown = 0;	   /* n_skipped() in the last summary */
+
+
+/** How many hosts to copy to or from at once, if -P is not given. */
+#define TRANSFER_PARALLEL 8
+/** How many hosts --adaptive starts with, if -P is not given. */
+#define ADAPTIVE_START 2
+/** The most hosts --adaptive will run at once, without --max-parallel. */
+#define ADAPTIVE_MAX 64
+/** Rewrite the --write-failed and --write-succeeded files at most this
+ * often (ms) while hosts are finishing. */
+#define WRITE_INTERVAL 1000
+/** How often (ms) to look for changes to the -N lists while hosts run. */
+#define WATCH_INTERVAL 500
+/** How many events --trace keeps, the most recent ones. */
+#define TRACE_EVENTS (1 << 20)
+
+static RunOps command_ops = {
+	command_step,
+	command_output,
+	command_done,
+};
+
+static RunOps script_ops = {
+	script_step,
+	command_output,
+	command_done,
+};
+
+static RunOps jobs_ops = {
+	jobs_step,
+	command_output,
+	command_done,
+};
+
+static RunOps transfer_ops = {
+	transfer_step,
+	transfer_output,
+	transfer_host_done,
+};
 
 
 int main(int argc, char **argv)
 {
+	int ret;
+	gchar *history_file;
 
+	myname = argv[0];
+	if (daemon_wanted(argc, argv)) {
+		// Only returns in a worker, with the job's arguments.
+		serve_jobs(&argc, &argv);
+	} else if (daemon_client(argc, argv, &ret)) {
+		return ret;
+	}
 	init();
+	daemon_context(fa);
 
-	myname = argv[0];
 	do_opts(argc, argv);
-	if (0 == n_hosts() && 0 == n_host_lists()) {
-		add_list(g_string_new("all"));
+	fa->debug = opt_debug;
+	fa->no_pty = opt_no_tty != 0;
+	if (opt_jobs) {
+		if (n_hosts(fa) || n_host_lists(fa) || opt_stdin_hosts || opt_expr
+		    || opt_command->len || opt_push || opt_pull || opt_script) {
+			fprintf(stderr, "%s: --jobs gives the hosts and "
+				"commands, so cannot have others\n", myname);
+			usage(0, 1);
+		}
+		jobs = read_jobs(fa, opt_jobs);
 	}
-	process_lists();
+	// -E can pick no hosts, which is not the same as not picking any.
+	if (0 == n_hosts(fa) && 0 == n_host_lists(fa) && ! opt_stdin_hosts
+	    && ! opt_expr) {
+		add_list(fa, g_string_new("all"));
+	}
+	// These need the whole list before they can start.
+	if (opt_stdin_hosts && (opt_sort || opt_reverse || opt_slowest_first
+				|| opt_list_only || opt_files
+				|| opt_threads > 1)) {
+		read_stdin_hosts();
+		opt_stdin_hosts = 0;
+	}
+	process_lists(fa);
+	if (opt_nshards) {
+		shard_hosts(fa, opt_shard, opt_nshards);
+	}
+	set_group_limits();
 
 	if (opt_debug)
 		debug_print_flags();
 
 	if (opt_sort) {
-		sort_hosts();
+		sort_hosts(fa);
 	}
 
 	if (opt_list_only) {
@@ -77,72 +206,616 @@ int main(int argc, char **argv)
 		exit(0);
 	}
 
-	if (0 == opt_command->len) {
+	if (0 == opt_command->len && ! opt_push && ! opt_pull && ! opt_script
+	    && ! opt_jobs) {
+		usage(0, 1);
+	}
+	if (opt_script && (opt_command->len || opt_push || opt_pull)) {
+		fprintf(stderr, "%s: --script cannot have a command, --push or "
+			"--pull\n", myname);
 		usage(0, 1);
 	}
-	if (0 == n_hosts()) {
+	if (0 == n_hosts(fa) && ! opt_stdin_hosts) {
 		fprintf(stderr, "No hosts specified\n");
 		exit(3);
 	}
-	if (opt_reverse) {
-		for (int i=n_hosts()-1; i>=0; i--) {
-			do_host(i);
+
+	if (opt_adaptive) {
+		// -P is where we start, and we never go past --max-parallel.
+		if (! opt_max_parallel) {
+			opt_max_parallel = ADAPTIVE_MAX;
+		}
+		fa->adaptive = new_adaptive(opt_parallel ? opt_parallel
+					    : ADAPTIVE_START,
+					    opt_max_parallel, opt_debug);
+		opt_parallel = opt_max_parallel;
+	} else if (opt_max_parallel && opt_parallel > opt_max_parallel) {
+		opt_parallel = opt_max_parallel;
+	}
+
+	if (opt_trace) {
+		fa->trace = new_trace(TRACE_EVENTS);
+	}
+	watch_not_lists(fa);
+	history_file = g_build_filename(g_get_user_cache_dir(), "for-all",
+					"durations", NULL);
+	fa->history = load_history(history_file);
+	g_free(history_file);
+
+	if (opt_push || opt_pull) {
+		Transfer *t;
+		if (opt_pull && (n_hosts(fa) > 1 || opt_stdin_hosts)
+		    && ! strstr(opt_transfer_to->str, "%h")) {
+			fprintf(stderr, "%s: --pull needs %%h in the local file "
+				"name when there is more than one host\n",
+				myname);
+			exit(3);
+		}
+		if (opt_push) {
+			t = new_transfer(fa, FALSE, opt_push->str,
+					 opt_transfer_to->str);
+		} else {
+			t = new_transfer(fa, TRUE, opt_transfer_to->str,
+					 opt_pull->str);
+		}
+		run_all(opt_parallel ? opt_parallel : TRANSFER_PARALLEL,
+			&transfer_ops, t);
+	} else if (opt_script) {
+		load_script();
+		run_all(opt_parallel ? opt_parallel : 1, &script_ops, 0);
+		if (opt_prefix && ! opt_quiet) {
+			print_s_f_lists();
+		}
+	} else if (opt_jobs) {
+		jobs_args = ssh_template(fa, SSH_NO_STDIN | SSH_TTY | SSH_MUX);
+		run_all(opt_parallel ? opt_parallel : 1, &jobs_ops, 0);
+		if (opt_prefix && ! opt_quiet) {
+			print_s_f_lists();
 		}
 	} else {
-		for (int i=0; i<n_hosts(); i++) {
-			do_host(i);
+		command_args = ssh_template(fa, SSH_NO_STDIN | SSH_TTY);
+		for (int i=0; i<opt_command->len; i++) {
+			add_command_word(command_args, a2g2c(opt_command, i));
+		}
+		run_all(opt_parallel ? opt_parallel : 1, &command_ops, 0);
+		if (opt_prefix && ! opt_quiet) {
+			print_s_f_lists();
+		}
+	}
+	save_history(fa->history);
+	if (opt_metrics_file) {
+		GError *error = 0;
+		if (! write_metrics(fa, opt_metrics_file, &error)) {
+			fprintf(stderr, "%s: %s\n", myname, error->message);
+			g_clear_error(&error);
 		}
 	}
+	if (opt_trace) {
+		GError *error = 0;
+		if (! write_trace(fa->trace, fa->names, opt_trace, &error)) {
+			fprintf(stderr, "%s: %s\n", myname, error->message);
+			g_clear_error(&error);
+		}
+		// Which takes away the fifo that ssh told us it connected on.
+		free_trace(fa->trace);
+		fa->trace = 0;
+	}
 
 	return 0;
 }
 
+
 /**
- * Run our command on one host.
+ * Run each host, writing out --prefix lines after each time round.
+ */
+static void run_all(int parallel, RunOps *ops, void *data)
+{
+	init_output(parallel > 1);
+	if (MIN(opt_threads, parallel) > 1) {
+		Pool *p = new_pool(fa, host_order(), parallel, opt_threads,
+				   ops, data);
+		// The workers write out --prefix lines as they come, and each
+		// host's held back output goes out here when it is done.
+		pool_rounds(p, flush_lines);
+		while (pool_iterate(p, between_rounds())) {
+			flush_lines();
+		}
+		free_pool(p);
+	} else {
+		Runner *r = new_runner(fa, host_order(), parallel, ops, data);
+		if (opt_stdin_hosts) {
+			runner_input(r, 0, stdin_hosts, 0);
+		}
+		while (runner_iterate(r, between_rounds())) {
+			flush_lines();
+		}
+		free_runner(r);
+	}
+	flush_lines();
+	write_host_files(TRUE);
+	// Hosts skipped after the last host finished aren't in its summary.
+	if (n_skipped(fa) != skipped_shown && ! opt_quiet && ! opt_single
+	    && ! opt_prefix) {
+		print_s_f_lists();
+	}
+	report_budget(parallel);
+}
+
+
+/**
+ * What to do each time round while the hosts run: bring the --write-failed
+ * and --write-succeeded files up to date, and see if the -N lists changed.
  *
- * We assume that the hosts are in one list, and just supply the index into
- * that list. Separating this out makes it easier to run the command in any
- * order.
+ * @return how long until this next needs doing (ms), or -1
+ */
+static int between_rounds(void)
+{
+	static gint64 watched_at = 0;
+	int wait = write_host_files(FALSE);
+	int due;
+	gint64 now;
+
+	if (! fa->watch) {
+		return wait;
+	}
+	now = g_get_monotonic_time();
+	due = (watched_at + WATCH_INTERVAL * 1000 - now + 999) / 1000;
+	if (due <= 0) {
+		check_not_lists(fa);
+		watched_at = now;
+		due = WATCH_INTERVAL;
+	}
+	if (-1 == wait || wait > due) {
+		wait = due;
+	}
+	return wait;
+}
+
+
+/**
+ * Read all the hosts from stdin (-H -) before we start.
+ */
+static void read_stdin_hosts(void)
+{
+	char *line = 0;
+	size_t size = 0;
+
+	while (-1 != getline(&line, &size, stdin)) {
+		add_host_line(fa, line, 0, 0);
+	}
+	free(line);
+}
+
+
+/**
+ * Apply --group-limit and --per-list-limit, now that the lists are read.
+ * Exits if a --group-limit names a list that we read no hosts from, unless
+ * more lists may come on stdin.
+ */
+static void set_group_limits(void)
+{
+	for (int i=0; i<opt_group_limits->len; i++) {
+		const char *arg = g_ptr_array_index(opt_group_limits, i);
+		const char *eq = strrchr(arg, '=');
+		gchar *name = g_strndup(arg, eq - arg);
+		HostGroup *hg = find_group(fa->groups, name);
+		if (! opt_stdin_hosts && (! hg || ! bitset_count(hg->members))) {
+			fprintf(stderr, "%s: --group-limit: no hosts came from "
+				"a list called \"%s\"\n", myname, name);
+			exit(3);
+		}
+		set_group_limit(fa->groups, name, atoi(eq + 1));
+		g_free(name);
+	}
+	if (opt_per_list_limit) {
+		set_per_list_limit(fa->groups, opt_per_list_limit);
+	}
+}
+
+
+/**
+ * There are more hosts on stdin (-H -).  Start each as soon as its line is
+ * complete, as long as it is new, not excluded, and in our shard.
+ */
+static void stdin_hosts(Runner *r, void *data)
+{
+	static GString *partial = 0;
+	char buf[4096];
+	char *p = buf;
+	char *end;
+	int readval;
+
+	if (! partial) {
+		partial = g_string_new("");
+	}
+	readval = read(0, buf, sizeof(buf));
+	if (-1 == readval && (EINTR == errno || EAGAIN == errno)) {
+		return;
+	}
+	if (readval <= 0) {
+		if (-1 == readval) {
+			fprintf(stderr, "%s: reading hosts: %s\n", myname,
+				strerror(errno));
+		}
+		if (partial->len) {
+			stdin_line(r, partial->str);
+		}
+		g_string_free(partial, TRUE);
+		partial = 0;
+		runner_input(r, -1, 0, 0);
+		return;
+	}
+	end = buf + readval;
+	while (p < end) {
+		char *nl = memchr(p, '\n', end - p);
+		if (! nl) {
+			g_string_append_len(partial, p, end - p);
+			break;
+		}
+		g_string_append_len(partial, p, nl - p + 1);
+		stdin_line(r, partial->str);
+		g_string_truncate(partial, 0);
+		p = nl + 1;
+	}
+}
+
+
+static void stdin_line(Runner *r, char *line)
+{
+	int n = add_host_line(fa, line, opt_shard, opt_nshards);
+
+	for (int i=n_hosts(fa)-n; i<n_hosts(fa); i++) {
+		runner_add(r, i);
+	}
+}
+
+
+/**
+ * Bring the --write-failed and --write-succeeded files up to date with the
+ * hosts that have finished, so a rerun on the failures can start before
+ * this run is over.  While hosts are still running the files are written at
+ * most once every WRITE_INTERVAL.
  *
- * If we're doing single line, print the hostname without a newline.
+ * @param final TRUE at the end of the run, to write them whatever
+ * @return how long until the files next need writing (ms), or -1
+ */
+static int write_host_files(int final)
+{
+	static gint64 written_at = 0;
+	static int written = -1;
+	gint64 now;
+	GError *error = 0;
+
+	if (! opt_write_failed && ! opt_write_succeeded) {
+		return -1;
+	}
+	if (! final && n_finished(fa) == written) {
+		return -1;
+	}
+	now = g_get_monotonic_time();
+	if (! final && now < written_at + WRITE_INTERVAL * 1000) {
+		return (written_at + WRITE_INTERVAL * 1000 - now + 999) / 1000;
+	}
+	if (opt_write_failed
+	    && ! write_hosts(fa, fa->failed, opt_write_failed, &error)) {
+		fprintf(stderr, "%s: %s\n", myname, error->message);
+		g_clear_error(&error);
+	}
+	if (opt_write_succeeded
+	    && ! write_hosts(fa, fa->succeeded, opt_write_succeeded, &error)) {
+		fprintf(stderr, "%s: %s\n", myname, error->message);
+		g_clear_error(&error);
+	}
+	written_at = now;
+	written = n_finished(fa);
+	return -1;
+}
+
+
+/**
+ * Say if the system's limits held us back, as that is why a big run went
+ * slower than -P would suggest.
+ */
+static void report_budget(int parallel)
+{
+	Budget *b = fa->budget;
+
+	if (! b->throttled && ! b->exhausted) {
+		return;
+	}
+	fprintf(stderr, "%s: ran at most %d of %d hosts at once (%s)",
+		myname, MIN(b->limit, parallel), parallel, b->why);
+	if (b->throttled) {
+		fprintf(stderr, "; %d hosts waited", b->throttled);
+	}
+	if (b->exhausted) {
+		fprintf(stderr, "; %d hosts could not start until another "
+			"finished", b->exhausted);
+	}
+	fprintf(stderr, "\n");
+}
+
+
+/**
+ * The order to do the hosts in.
  *
- * @param i the index of the host
+ * @return a new array of indexes (int) into the hosts list
  */
-static void do_host(int i)
+static GArray *host_order(void)
 {
-	GString *hostname = get_host(i);
-	if (! opt_quiet) {
+	GArray *order = g_array_sized_new(FALSE, FALSE, sizeof(int), n_hosts(fa));
+
+	if (opt_reverse) {
+		for (int i=n_hosts(fa)-1; i>=0; i--) {
+			g_array_append_val(order, i);
+		}
+	} else {
+		for (int i=0; i<n_hosts(fa); i++) {
+			g_array_append_val(order, i);
+		}
+	}
+	if (opt_slowest_first) {
+		// Longest processing time first.  Hosts we haven't seen before
+		// count as average.
+		int *ms = g_new(int, n_hosts(fa));
+		gint64 total = 0;
+		int known = 0;
+		for (int i=0; i<n_hosts(fa); i++) {
+			ms[i] = history_get(fa->history, get_host(fa, i));
+			if (ms[i] >= 0) {
+				total += ms[i];
+				known ++;
+			}
+		}
+		for (int i=0; i<n_hosts(fa); i++) {
+			if (ms[i] < 0) {
+				ms[i] = known ? total / known : 0;
+			}
+		}
+		g_array_sort_with_data(order, compare_slowest, ms);
+		g_free(ms);
+	}
+	return order;
+}
+
+
+/**
+ * Slowest host first, and otherwise keep the order we had.
+ */
+static gint compare_slowest(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const int *ms = data;
+	int ia = *(const int *) a;
+	int ib = *(const int *) b;
+
+	if (ms[ia] != ms[ib]) {
+		return ms[ia] > ms[ib] ? -1 : 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Add a word of the remote command to an ssh template.  Only --template fills
+ * in the % tokens, as commands such as date have their own.
+ */
+static void add_command_word(Template *t, const char *word)
+{
+	if (opt_template) {
+		template_add(t, word);
+	} else {
+		template_add_literal(t, word);
+	}
+}
+
+
+/**
+ * Read the --script file.  Each line that isn't blank or a # comment is a
+ * step, run by the remote shell.  The steps to a host share one ssh
+ * connection.  Exits if the file cannot be read or has no steps.
+ */
+static void load_script(void)
+{
+	gchar *contents;
+	gchar **lines;
+	GError *error = 0;
+
+	if (! g_file_get_contents(opt_script, &contents, 0, &error)) {
+		fprintf(stderr, "%s: %s\n", myname, error->message);
+		exit(3);
+	}
+	script_args = g_ptr_array_new();
+	lines = g_strsplit(contents, "\n", -1);
+	for (int i=0; lines[i]; i++) {
+		const char *line = g_strstrip(lines[i]);
+		Template *t;
+		if (! *line || '#' == *line) {
+			continue;
+		}
+		t = ssh_template(fa, SSH_NO_STDIN | SSH_TTY | SSH_MUX);
+		add_command_word(t, line);
+		ga(script_args, t);
+	}
+	g_strfreev(lines);
+	g_free(contents);
+	if (0 == script_args->len) {
+		fprintf(stderr, "%s: no steps in %s\n", myname, opt_script);
+		exit(3);
+	}
+}
+
+
+/**
+ * Set up our command for one host.  There is only one step.
+ */
+static int command_step(HostRun *hr, void *data)
+{
+	if (hr->step > 0) {
+		return FALSE;
+	}
+	return start_command(hr, command_args, 0);
+}
+
+
+/**
+ * Set up the next --script step for one host.  Each host goes through the
+ * steps on its own, and stops at the first one that fails.
+ */
+static int script_step(HostRun *hr, void *data)
+{
+	if (hr->step >= script_args->len
+	    || (hr->step > 0 && 0 != hr->status)) {
+		return FALSE;
+	}
+	return start_command(hr, g_ptr_array_index(script_args, hr->step), 0);
+}
+
+
+/**
+ * Set up the next --jobs command for one host.  A host with more than one
+ * job runs them in turn, like --script steps.  hr->data is the job we ran
+ * last, plus one.
+ */
+static int jobs_step(HostRun *hr, void *data)
+{
+	guint32 job;
+
+	if (0 == hr->step) {
+		job = first_job(jobs, hr->id);
+	} else if (0 != hr->status) {
+		return FALSE;
+	} else {
+		job = next_job(jobs, GPOINTER_TO_UINT(hr->data) - 1);
+	}
+	if (NO_JOB == job) {
+		return FALSE;
+	}
+	hr->data = GUINT_TO_POINTER(job + 1);
+	return start_command(hr, jobs_args, job_command(jobs, job));
+}
+
+
+/**
+ * If we're doing single line, print the hostname without a newline.  With
+ * --prefix, the host name goes on each line instead.  The host name only goes
+ * before the first step.
+ */
+static int start_command(HostRun *hr, Template *args, const char *command)
+{
+	if (! opt_quiet && ! opt_prefix && 0 == hr->step) {
 		if (opt_single) {
-			printf("%-*s", hosts_name_length(), hostname->str);
-			fflush(stdout);
+			host_printf(hr, "%-*s", hosts_name_length(fa),
+				    hr->host);
 		} else {
-			printf("\n-- %s\n", hostname->str);
+			host_printf(hr, "\n-- %s", hr->host);
+			if (hr->attempt) {
+				host_printf(hr, " (retry %d)", hr->attempt);
+			}
+			host_write(hr, "\n", 1);
+		}
+	}
+
+	host_args(fa, hr, args);
+	if (command) {
+		ga(hr->args, (char *) command);
+	}
+
+	if (! opt_quiet && ! opt_single && ! opt_prefix) {
+		for (int i=0; i<hr->args->len; i++) {
+			if (i)
+				host_write(hr, " ", 1);
+			if (opt_debug)
+				host_write(hr, "{", 1);
+			host_printf(hr, "%s", a2c(hr->args, i));
+			if (opt_debug)
+				host_write(hr, "}", 1);
 		}
+		host_write(hr, "\n", 1);
+	}
+	return TRUE;
+}
+
+
+static void command_output(HostRun *hr, const char *buf, int len, void *data)
+{
+	if (opt_prefix) {
+		host_lines(hr, buf, len);
+	} else {
+		host_write(hr, buf, len);
+	}
+}
+
+
+/**
+ * The command has finished on one host.
+ *
+ * Detect if the last line of output (if there was any output) was terminated
+ * by a newline. If there was no output, or the last character was not a
+ * newline, add a newline. Don't do this if -q was specified.
+ *
+ * With --prefix, the summary is printed once at the end instead.
+ */
+static void command_done(HostRun *hr, void *data)
+{
+	if (opt_prefix) {
+		host_lines_end(hr);
+		record_host(hr);
+		return;
+	}
+	if (! opt_quiet && '\n' != hr->lastchar) {
+		host_write(hr, "\n", 1);
 	}
-	run_command(opt_ssh_program,
-		    opt_ssh_options,
-		    hostname,
-		    opt_command,
-		    opt_single,
-		    opt_debug);
+	record_host(hr);
+	host_flush(hr);
 	if (! opt_quiet && ! opt_single) {
 		print_s_f_lists();
 	}
 }
 
 
+/**
+ * With --script, or --jobs with more than one job for the host, a host that
+ * failed also records which step it got to.
+ */
+static void record_host(HostRun *hr)
+{
+	HostStatus *st;
+	int steps = script_args != 0;
+
+	record_result(fa, hr, RESULT_OK);
+	st = get_status(fa, hr->id);
+	if (jobs && NO_JOB != first_job(jobs, hr->id)) {
+		steps = NO_JOB != next_job(jobs, first_job(jobs, hr->id));
+	}
+	if (steps && ! status_ok(st)) {
+		// The step has moved on past the one that failed.
+		st->step = MIN(hr->step, G_MAXUINT8);
+	}
+}
+
+
+static void transfer_host_done(HostRun *hr, void *data)
+{
+	transfer_done(hr, data);
+	host_flush(hr);
+	if (! opt_quiet) {
+		print_s_f_lists();
+	}
+}
+
+
 /**
  * List all the hosts on stdout.
  */
 static void list_hosts(void)
 {
 	printf("Hosts:\n");
-	for (int i=0; i<n_hosts(); i++) {
-		printf("        %s\n", g2c(get_host(i)));
+	for (int i=0; i<n_hosts(fa); i++) {
+		printf("        %s\n", get_host(fa, i));
 	}
 	printf("Not hosts:\n");
-	for (int i=0; i<n_not_hosts(); i++) {
-		printf("        %s\n", g2c(get_not_host(i)));
+	for (int i=0; i<n_not_hosts(fa); i++) {
+		printf("        %s\n", get_not_host(fa, i));
 	}
 }
 
@@ -153,15 +826,15 @@ static void list_hosts(void)
 static void list_files(void)
 {
 	printf("Lists:\n");
-	for (int i=0; i<n_host_lists(); i++) {
-		HostListName *hln = get_host_list(i);
+	for (int i=0; i<n_host_lists(fa); i++) {
+		HostListName *hln = get_host_list(fa, i);
 		GString *pathname = hln->pathname;
 		char *name = pathname->str;
 		printf("        %s\n", name);
 	}
 	printf("Not lists:\n");
-	for (int i=0; i<n_not_host_lists(); i++) {
-		HostListName *hln = get_host_list(i);
+	for (int i=0; i<n_not_host_lists(fa); i++) {
+		HostListName *hln = get_host_list(fa, i);
 		GString *pathname = hln->pathname;
 		char *name = pathname->str;
 		printf("        %s\n", name);
@@ -175,18 +848,58 @@ static void list_files(void)
 static void print_s_f_lists(void)
 {
 	printf("\n----\n");
-	if (n_successes()) {
+	if (n_successes(fa)) {
 		printf("%s:\n", "Success");
-		for (int i=0; i<n_successes(); i++) {
-			printf("\t%s\n", get_success(i)->str);
-		}
+		print_results(fa->succeeded);
 	}
-	if (n_failures()) {
+	if (n_failures(fa)) {
 		printf("%s:\n", "Failure");
-		for (int i=0; i<n_failures(); i++) {
-			printf("\t%s\n", get_failure(i)->str);
+		print_results(fa->failed);
+	}
+	if (n_skipped(fa)) {
+		printf("%s:\n", "Skipped");
+		print_skipped();
+	}
+	skipped_shown = n_skipped(fa);
+}
+
+
+/**
+ * Print the hosts that the -N lists excluded after the run began.
+ */
+static void print_skipped(void)
+{
+	for (HostId id=bitset_next(fa->skipped, 0); NO_HOST != id;
+	     id=bitset_next(fa->skipped, id + 1)) {
+		printf("\t%-*s # excluded by -N during the run\n", host_len(fa),
+		       name_of(fa->names, id));
+	}
+}
+
+
+/**
+ * Print the hosts in a set that have finished, in the order they finished,
+ * with how each went lined up after the names.
+ */
+static void print_results(Bitset *which)
+{
+	GString *gs = g_string_new("");
+
+	for (int i=0; i<n_finished(fa); i++) {
+		HostId id = get_finished(fa, i);
+		if (! bitset_has(which, id)) {
+			continue;
+		}
+		g_string_truncate(gs, 0);
+		append_status(fa, gs, get_status(fa, id));
+		if (gs->len) {
+			printf("\t%-*s # %s\n", host_len(fa),
+			       name_of(fa->names, id), gs->str);
+		} else {
+			printf("\t%s\n", name_of(fa->names, id));
 		}
 	}
+	g_string_free(gs, TRUE);
 }
 
 
@@ -196,48 +909,121 @@ static void print_s_f_lists(void)
  */
 static void init(void)
 {
-	init_lists();
-	opt_ssh_program = g_string_new("ssh");
-
-	opt_ssh_options = g_ptr_array_new();
+	fa = new_forall(myname);
 
 	opt_command = g_ptr_array_new();
+	opt_group_limits = g_ptr_array_new();
 }
 
 
-/** Needs 3 myname.  */
+/** Needs 7 myname.  */
 static const char * const usage_message = "\
 Usage: %s [options] [-H list] [hosts] -- command\n\
+       %s [options] [-H list] [hosts] --push local remote\n\
+       %s [options] [-H list] [hosts] --pull remote local/%%h\n\
+       %s [options] [-H list] [hosts] --script file\n\
+       %s [options] --jobs file\n\
        %s [options] [-H list] [hosts] -L\n\
        %s [options] [-H list] [hosts] -F\n";
-/** Needs 0 myname. */
-static const char * const long_usage_message = "\
+/**
+ * Needs 0 myname.  In pieces, to keep each one inside the length of string
+ * that C99 compilers have to support.
+ */
+static const char * const long_usage_message[] = { "\
   * means not implemented\n\
     -h|--help       This help\n\
     -V|--version    Print version and exit\n\
     -1|--single     Output on a single line, with host name\n\
                     Turns on -q\n\
+    -E expr|--expr=expr\n\
+                    Hosts from lists combined with & (in both),\n\
+                    | (in either) and - (in the first but not the\n\
+                    second), eg -E 'all & linux - (db | web)'\n\
     -F|--files      Show which list files are read\n\
     -H file|--hostlist=file\n\
-                    File with list of hosts, one per line\n\
+                    File with list of hosts, one per line.  With -H -,\n\
+                    each host on stdin starts as soon as it is read\n\
     -L|--list-only  List hosts from files, do not run command - the\n\
                     command is not required here.\n\
     -n h|--not h    Exclude host h\n\
     -N file|--notlist=file\n\
-                    Exclude hosts in this list\n\
+                    Exclude hosts in this list.  Hosts added to it\n\
+                    during the run are skipped if they haven't started\n\
     -o sshoption    Add \"-o sshoption\" to the ssh command line\n\
+    -P n|--parallel=n\n\
+                    Run on n hosts at once (default 1, or 8 for\n\
+                    --push and --pull)\n\
+    --adaptive      Start with -P hosts at once (default 2), and run\n\
+                    more while hosts keep responding quickly\n\
+    --max-parallel=n\n\
+                    Never run more than n hosts at once (default 64\n\
+                    with --adaptive)\n\
+    --push local remote\n\
+                    Copy the local file to remote on each host,\n\
+                    unless it is already the same\n\
+    --pull remote local\n\
+                    Copy remote from each host to local, where %%h\n\
+                    in local is replaced by the host name\n\
+    --script file   Run each line of file on each host in turn, over\n\
+                    one connection, stopping at the first that fails\n\
+    --jobs file     Run a command per host, from \"host<tab>command\"\n\
+                    lines in file (- for stdin)\n\
+    --template      Fill in %%h, %%i and %%u in the command or script\n\
+    --prefix        Print each line of output as soon as it arrives,\n\
+                    as \"host: line\"\n\
+    --retries=n     Retry a host up to n times if ssh cannot reach it\n\
+                    (exit 255), after the other hosts have started\n\
+    --retry-backoff=ms\n\
+                    Wait about this long before the first retry, and\n\
+                    twice as long before each after that (default 1000)\n\
+", "\
+    --daemon        Run jobs for other for-all commands, keeping the\n\
+                    host lists and ssh connections between them\n\
+    --no-daemon     Run this command here, even if a daemon is running\n\
     -q              Quiet (do not print commands and machine names)\n\
     -S prog|--ssh-program=prog\n\
                     Use prog as ssh command (experimental)\n\
     -s|--sort       Sort the host list\n\
     -r              Do the list in reverse\n\
-  * -T|--no-tty     Don't allocate a tty\n\
-  * -u user         Run commands as user\n\
+    --order=slowest-first\n\
+                    Start the hosts that took longest last time first\n\
+    --order=list    Start the hosts in list order (default)\n\
+    --shard=i/N     Only run on the i'th of N shares of the hosts,\n\
+                    chosen by a hash of the host name\n\
+    --write-failed=file\n\
+                    Write the hosts that failed to file as a host\n\
+                    list, updated as hosts finish\n\
+    --write-succeeded=file\n\
+                    The same for the hosts that succeeded\n\
+    --max-output=n  Keep at most n bytes (or nk, nM) of output from\n\
+                    each host, and drop the rest\n\
+    --keep=both|head|tail\n\
+                    Which part of the output --max-output keeps\n\
+                    (default both, half from each end)\n\
+    --timeout=s     Kill a host's command if it runs for more than s\n\
+                    seconds, and count the host as failed\n\
+    --metrics-file=file\n\
+                    Write how the run went to file, in Prometheus text\n\
+                    format, for node_exporter's textfile collector\n\
+    --io=epoll|poll How to wait for output (default epoll, where there\n\
+                    is one)\n\
+    --group-limit=list=n\n\
+                    Run at most n hosts at once from the list file\n\
+                    list, and the lists it includes\n\
+    --per-list-limit=n\n\
+                    Run at most n hosts at once from each list file\n\
+    --threads=n     Share the hosts out between n threads, for when\n\
+                    one can't keep up with the output (default 1)\n\
+    --trace=file    Write what happened to each host, and when, to\n\
+                    file in Chrome trace format (for Perfetto)\n\
+    -T|--no-tty     Run ssh on a pipe, without a tty at either end\n\
+    -u user         Log in to each host as user\n\
     [hosts]         Optionally specify hosts to operate on - if none\n\
                     specified and no list specified, defaults to the\n\
                     \"all\" list\n\
     --              \"--\" must be used to separate options, host names,\n\
                     and the command\n\
+", "\
 \n\
  Hosts can be specified as:\n\
    - non-option arguments before the -- separator, or\n\
@@ -246,7 +1032,9 @@ static const char * const long_usage_message = "\
  Host lists can contain blank lines or comments starting with #.\n\
  Host list defaults to all.\n\
  \"-- command\" must be supplied\n\
-";
+ With --template, %%h in the command is the host, %%i its index in the\n\
+ host list, %%u the user, and %%%% is %%.\n\
+", 0 };
 
 
 static void usage(int longusage, int ret)
@@ -256,30 +1044,86 @@ static void usage(int longusage, int ret)
 		f = stderr;
 	else
 		f = stdout;
-	fprintf(f, usage_message, myname, myname, myname);
-	if (longusage)
-		fprintf(f, long_usage_message);
+	fprintf(f, usage_message, myname, myname, myname, myname, myname,
+		myname, myname);
+	if (longusage) {
+		for (int i=0; long_usage_message[i]; i++) {
+			fprintf(f, long_usage_message[i]);
+		}
+	}
 	exit(ret);
 }
 
 
-static const char* const short_options = "-1DFhH:LqsS:u:n:N:rTo:V";
+/** Long options that have no short option. */
+enum {
+	OPT_PUSH = 256,
+	OPT_PULL,
+	OPT_MAX_PARALLEL,
+	OPT_DAEMON,
+	OPT_RETRIES,
+	OPT_RETRY_BACKOFF,
+	OPT_ORDER,
+	OPT_SHARD,
+	OPT_WRITE_FAILED,
+	OPT_WRITE_SUCCEEDED,
+	OPT_TRACE,
+	OPT_METRICS_FILE,
+	OPT_TIMEOUT,
+	OPT_MAX_OUTPUT,
+	OPT_KEEP,
+	OPT_SCRIPT,
+	OPT_JOBS,
+	OPT_IO,
+	OPT_THREADS,
+	OPT_GROUP_LIMIT,
+	OPT_PER_LIST_LIMIT,
+};
+
+static const char* const short_options = "-1DE:FhH:LqsS:u:n:N:P:rTo:V";
 static const struct option long_options[] = {
+	{ "adaptive"    ,       no_argument,    &opt_adaptive,  1  },
+	{ "daemon"      ,       no_argument,                0, OPT_DAEMON },
 	{ "debug"       , optional_argument,                0, 'D' },
+	{ "expr"        , required_argument,                0, 'E' },
 	{ "files"       ,       no_argument,       &opt_files, 'F' },
+	{ "group-limit" , required_argument,                0, OPT_GROUP_LIMIT },
 	{ "help"        ,       no_argument,                0, 'h' },
+	{ "prefix"      ,       no_argument,      &opt_prefix,  1  },
 	{ "quiet"       ,       no_argument,       &opt_quiet, 'q' },
+	{ "retries"     , required_argument,                0, OPT_RETRIES },
+	{ "retry-backoff", required_argument,               0, OPT_RETRY_BACKOFF },
 	{ "host-list"   , required_argument,                0, 'H' },
+	{ "io"          , required_argument,                0, OPT_IO },
+	{ "jobs"        , required_argument,                0, OPT_JOBS },
+	{ "keep"        , required_argument,                0, OPT_KEEP },
 	{ "list-only"   ,       no_argument,   &opt_list_only, 'L' },
+	{ "max-output"  , required_argument,                0, OPT_MAX_OUTPUT },
+	{ "max-parallel", required_argument,                0, OPT_MAX_PARALLEL },
+	{ "metrics-file", required_argument,                0, OPT_METRICS_FILE },
+	{ "no-daemon"   ,       no_argument,                0, OPT_DAEMON },
 	{ "not"         , required_argument,                0, 'n' },
 	{ "not-list"    , required_argument,                0, 'N' },
+	{ "order"       , required_argument,                0, OPT_ORDER },
+	{ "parallel"    , required_argument,                0, 'P' },
+	{ "per-list-limit", required_argument,              0, OPT_PER_LIST_LIMIT },
+	{ "pull"        , required_argument,                0, OPT_PULL },
+	{ "push"        , required_argument,                0, OPT_PUSH },
+	{ "script"      , required_argument,                0, OPT_SCRIPT },
+	{ "shard"       , required_argument,                0, OPT_SHARD },
 	{ "single"      ,       no_argument,      &opt_single, '1' },
 	{ "ssh-option"  , required_argument,                0, 'o' },
 	{ "ssh-program" , required_argument,                0, 'S' },
 	{ "sort"        ,       no_argument,        &opt_sort, 's' },
+	{ "template"    ,       no_argument,    &opt_template,  1  },
+	{ "threads"     , required_argument,                0, OPT_THREADS },
+	{ "timeout"     , required_argument,                0, OPT_TIMEOUT },
+	{ "trace"       , required_argument,                0, OPT_TRACE },
 	{ "no-tty"      ,       no_argument,      &opt_no_tty, 'T' },
 	{ "user"        , required_argument,                0, 'u' },
 	{ "version"     ,       no_argument,                0, 'V' },
+	{ "write-failed", required_argument,                0, OPT_WRITE_FAILED },
+	{ "write-succeeded", required_argument,             0, OPT_WRITE_SUCCEEDED },
 	{ 0             ,                 0,                0,  0  }
 };
 
@@ -295,9 +1139,13 @@ static void do_opts(int argc, char **argv)
 	while (1) {
 		//int this_option_optind = optind ? optind : 1;
 		int option_index = 0;
+		char junk;
+		char *end;
+		double seconds;
 		int c = getopt_long(argc, argv, short_options, long_options,
 				    &option_index);
 		GString *gs;
+		Bitset *set;
 
 		if (c == -1)
 			break;
@@ -306,8 +1154,7 @@ static void do_opts(int argc, char **argv)
 			// case 1 is for non-option arguments, up to "--".
 			// That is specified by the leading '-' in
 			// short_options.
-			gs = g_string_new(optarg);
-			add_host(gs);
+			add_host(fa, optarg);
 			break;
 		case '1':
 			opt_single = 1;
@@ -315,6 +1162,15 @@ static void do_opts(int argc, char **argv)
 		case 'D':
 			opt_debug ++;
 			break;
+		case 'E':
+			set = list_expr(fa, optarg);
+			if (! set) {
+				exit(3);
+			}
+			add_host_set(fa, set);
+			free_bitset(set);
+			opt_expr = 1;
+			break;
 		case 'F':
 			opt_files = 1;
 			break;
@@ -322,23 +1178,191 @@ static void do_opts(int argc, char **argv)
 			usage(1, 0);
 			break;
 		case 'H':
+			if (0 == strcmp(optarg, "-")) {
+				opt_stdin_hosts = 1;
+				break;
+			}
 			gs = g_string_new(optarg);
-			add_list(gs);
+			add_list(fa, gs);
 			break;
 		case 'L':
 			opt_list_only = 'L';
 			break;
 		case 'n':
-			gs = g_string_new(optarg);
-			add_not_host(gs);
+			add_not_host(fa, optarg);
 			break;
 		case 'N':
 			gs = g_string_new(optarg);
-			add_not_list(gs);
+			add_not_list(fa, gs);
 			break;
 		case 'o':
 			gs = g_string_new(optarg);
-			ga(opt_ssh_options, gs);
+			ga(fa->ssh_options, gs);
+			break;
+		case 'P':
+			opt_parallel = atoi(optarg);
+			if (opt_parallel < 1) {
+				fprintf(stderr, "%s: bad -P value \"%s\"\n",
+					myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_MAX_PARALLEL:
+			opt_max_parallel = atoi(optarg);
+			if (opt_max_parallel < 1) {
+				fprintf(stderr, "%s: bad --max-parallel value "
+					"\"%s\"\n", myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_RETRIES:
+			fa->retries = atoi(optarg);
+			if (fa->retries < 0 || ! isdigit(optarg[0])) {
+				fprintf(stderr, "%s: bad --retries value \"%s\"\n",
+					myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_RETRY_BACKOFF:
+			fa->retry_backoff = atoi(optarg);
+			if (fa->retry_backoff < 0 || ! isdigit(optarg[0])) {
+				fprintf(stderr, "%s: bad --retry-backoff value "
+					"\"%s\"\n", myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_ORDER:
+			if (0 == strcmp(optarg, "slowest-first")) {
+				opt_slowest_first = 1;
+			} else if (0 == strcmp(optarg, "list")) {
+				opt_slowest_first = 0;
+			} else {
+				fprintf(stderr, "%s: bad --order value \"%s\"\n",
+					myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_SHARD:
+			if (2 != sscanf(optarg, "%d/%d%c", &opt_shard,
+					&opt_nshards, &junk)
+			    || opt_nshards < 1 || opt_shard < 1
+			    || opt_shard > opt_nshards) {
+				fprintf(stderr, "%s: bad --shard value \"%s\"\n",
+					myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_TRACE:
+			opt_trace = optarg;
+			break;
+		case OPT_MAX_OUTPUT:
+			fa->max_output = g_ascii_strtoll(optarg, &end, 10);
+			if ('k' == *end || 'K' == *end) {
+				fa->max_output *= 1024;
+				end ++;
+			} else if ('m' == *end || 'M' == *end) {
+				fa->max_output *= 1024 * 1024;
+				end ++;
+			}
+			if (end == optarg || *end || fa->max_output < 1) {
+				fprintf(stderr, "%s: bad --max-output value "
+					"\"%s\"\n", myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_KEEP:
+			if (0 == strcmp(optarg, "head")) {
+				fa->keep = KEEP_HEAD;
+			} else if (0 == strcmp(optarg, "tail")) {
+				fa->keep = KEEP_TAIL;
+			} else if (0 == strcmp(optarg, "both")) {
+				fa->keep = KEEP_BOTH;
+			} else {
+				fprintf(stderr, "%s: bad --keep value \"%s\"\n",
+					myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_METRICS_FILE:
+			opt_metrics_file = optarg;
+			break;
+		case OPT_SCRIPT:
+			opt_script = optarg;
+			break;
+		case OPT_JOBS:
+			opt_jobs = optarg;
+			break;
+		case OPT_IO:
+			if (0 == strcmp(optarg, "poll")) {
+				fa->use_poll = TRUE;
+			} else if (0 == strcmp(optarg, "epoll")) {
+				fa->use_poll = FALSE;
+			} else {
+				fprintf(stderr, "%s: bad --io value \"%s\"\n",
+					myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_GROUP_LIMIT:
+			end = strrchr(optarg, '=');
+			if (! end || end == optarg || atoi(end + 1) < 1) {
+				fprintf(stderr, "%s: bad --group-limit value "
+					"\"%s\", need list=n\n", myname, optarg);
+				usage(0, 1);
+			}
+			ga(opt_group_limits, optarg);
+			break;
+		case OPT_PER_LIST_LIMIT:
+			opt_per_list_limit = atoi(optarg);
+			if (opt_per_list_limit < 1) {
+				fprintf(stderr, "%s: bad --per-list-limit value "
+					"\"%s\"\n", myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_THREADS:
+			opt_threads = atoi(optarg);
+			if (opt_threads < 1) {
+				fprintf(stderr, "%s: bad --threads value "
+					"\"%s\"\n", myname, optarg);
+				usage(0, 1);
+			}
+			break;
+		case OPT_TIMEOUT:
+			seconds = strtod(optarg, &end);
+			if (end == optarg || *end || seconds <= 0
+			    || seconds > G_MAXINT / 1000) {
+				fprintf(stderr, "%s: bad --timeout value \"%s\"\n",
+					myname, optarg);
+				usage(0, 1);
+			}
+			fa->timeout = seconds * 1000;
+			break;
+		case OPT_WRITE_FAILED:
+			opt_write_failed = optarg;
+			break;
+		case OPT_WRITE_SUCCEEDED:
+			opt_write_succeeded = optarg;
+			break;
+		case OPT_DAEMON:
+			// Dealt with before we get here.
+			break;
+		case OPT_PUSH:
+		case OPT_PULL:
+			// These take two arguments, the second being the next
+			// word on the command line.
+			if (optind >= argc) {
+				fprintf(stderr, "%s: --%s needs two arguments\n",
+					myname, OPT_PUSH == c ? "push" : "pull");
+				usage(0, 1);
+			}
+			gs = g_string_new(optarg);
+			if (OPT_PUSH == c) {
+				opt_push = gs;
+			} else {
+				opt_pull = gs;
+			}
+			opt_transfer_to = g_string_new(argv[optind++]);
 			break;
 		case 'q':
 			opt_quiet = 'q';
@@ -350,13 +1374,17 @@ static void do_opts(int argc, char **argv)
 			opt_sort = 's';
 			break;
 		case 'S':
-			opt_ssh_program = g_string_new(optarg);
+			g_string_assign(fa->ssh, optarg);
 			break;
 		case 'T':
 			opt_no_tty = 'T';
 			break;
 		case 'u':
-			opt_user = g_string_new(optarg);
+			if (fa->user) {
+				g_string_assign(fa->user, optarg);
+			} else {
+				fa->user = g_string_new(optarg);
+			}
 			break;
 		case 'V':
 			printf("%s\n", version);
@@ -385,27 +1413,27 @@ static void debug_print_flags(void)
 	DD(1) if (opt_files) {
 		printf("opt_files\n");
 	}
-	DD(1) if (n_hosts()) {
-		for (int j=0; j<n_hosts(); j++) {
-			printf("host: %s\n", g2c(get_host(j)));
+	DD(1) if (n_hosts(fa)) {
+		for (int j=0; j<n_hosts(fa); j++) {
+			printf("host: %s\n", get_host(fa, j));
 		}
 	}
-	DD(2) if (n_host_lists()) {
-		for (int j=0; j<n_host_lists(); j++) {
-			printf("host list: %s\n", g2c(get_host_list(j)));
+	DD(2) if (n_host_lists(fa)) {
+		for (int j=0; j<n_host_lists(fa); j++) {
+			printf("host list: %s\n", g2c(get_host_list(fa, j)));
 		}
 	}
 	DD(2) if (opt_list_only) {
 		printf("opt_list_only\n");
 	}
-	DD(2) if (n_not_hosts()) {
-		for (int j=0; j<n_not_hosts(); j++) {
-			printf("not: %s\n", g2c(get_not_host(j)));
+	DD(2) if (n_not_hosts(fa)) {
+		for (int j=0; j<n_not_hosts(fa); j++) {
+			printf("not: %s\n", get_not_host(fa, j));
 		}
 	}
-	DD(2) if (n_not_host_lists()) {
-		for (int j=0; j<n_not_host_lists(); j++) {
-			printf("not list: %s\n", g2c(get_not_host_list(j)));
+	DD(2) if (n_not_host_lists(fa)) {
+		for (int j=0; j<n_not_host_lists(fa); j++) {
+			printf("not list: %s\n", g2c(get_not_host_list(fa, j)));
 		}
 	}
 	DD(1) if (opt_quiet) {
@@ -420,20 +1448,80 @@ static void debug_print_flags(void)
 	DD(1) if (opt_sort) {
 		printf("opt_sort\n");
 	}
-	DD(1) if (opt_ssh_options->len) {
-		for (int j=0; j<opt_ssh_options->len; j++) {
+	DD(1) if (opt_parallel) {
+		printf("opt_parallel: %d\n", opt_parallel);
+	}
+	DD(1) if (opt_adaptive) {
+		printf("opt_adaptive\n");
+	}
+	DD(1) if (opt_template) {
+		printf("opt_template\n");
+	}
+	DD(1) if (opt_max_parallel) {
+		printf("opt_max_parallel: %d\n", opt_max_parallel);
+	}
+	DD(1) for (int i=0; i<opt_group_limits->len; i++) {
+		printf("group_limit: %s\n",
+		       (char *) g_ptr_array_index(opt_group_limits, i));
+	}
+	DD(1) if (opt_per_list_limit) {
+		printf("opt_per_list_limit: %d\n", opt_per_list_limit);
+	}
+	DD(1) if (opt_threads > 1) {
+		printf("opt_threads: %d\n", opt_threads);
+	}
+	DD(1) if (fa->retries) {
+		printf("retries: %d, backoff %dms\n",
+		       fa->retries, fa->retry_backoff);
+	}
+	DD(1) if (opt_nshards) {
+		printf("shard: %d/%d\n", opt_shard, opt_nshards);
+	}
+	DD(1) if (opt_write_failed) {
+		printf("opt_write_failed: %s\n", opt_write_failed);
+	}
+	DD(1) if (opt_write_succeeded) {
+		printf("opt_write_succeeded: %s\n", opt_write_succeeded);
+	}
+	DD(1) if (fa->max_output) {
+		printf("max_output: %" G_GINT64_FORMAT ", keep %d\n",
+		       fa->max_output, fa->keep);
+	}
+	DD(1) if (fa->timeout) {
+		printf("timeout: %dms\n", fa->timeout);
+	}
+	DD(1) if (opt_metrics_file) {
+		printf("opt_metrics_file: %s\n", opt_metrics_file);
+	}
+	DD(1) if (opt_trace) {
+		printf("opt_trace: %s\n", opt_trace);
+	}
+	DD(1) if (opt_slowest_first) {
+		printf("opt_slowest_first\n");
+	}
+	DD(1) if (opt_prefix) {
+		printf("opt_prefix\n");
+	}
+	DD(1) if (opt_push) {
+		printf("opt_push: %s %s\n", opt_push->str, opt_transfer_to->str);
+	}
+	DD(1) if (opt_pull) {
+		printf("opt_pull: %s %s\n", opt_pull->str, opt_transfer_to->str);
+	}
+	DD(1) if (fa->ssh_options->len) {
+		for (int j=0; j<fa->ssh_options->len; j++) {
 			printf("ssh option: %s\n",
-			       ((GString *)g_ptr_array_index(opt_ssh_options, j))->str);
+			       ((GString *)g_ptr_array_index(fa->ssh_options, j))->str);
 		}
 	}
-	DD(1) if (opt_ssh_program) {
-		printf("opt_ssh_program: %s\n", opt_ssh_program->str);
+	DD(1) {
+		printf("ssh program: %s\n", fa->ssh->str);
 	}
 	DD(1) if (opt_no_tty) {
 		printf("opt_no_tty\n");
 	}
-	DD(1) if (opt_user) {
-		printf("opt_user: %s\n", opt_user->str);
+	DD(1) if (fa->user) {
+		printf("user: %s\n", fa->user->str);
 	}
 	DD(1) if (opt_command->len) {
 		for (int i=0; i<opt_command->len; i++) {
@@ -0,0 +1,214 @@
+/*
+ * Which list files each host came from, and limits on how many hosts from
+ * one list run at once.  Lists often follow the network, eg "all" includes
+ * "perth" and "darwin", so a limit on "darwin" keeps a thin link to that
+ * office from being flooded while the rest run flat out.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "groups.h"
+
+
+static void free_group(gpointer data);
+static int has_room(Groups *g, HostGroup *hg, HostId id);
+static int take_one(gint *running, int limit, GPtrArray *taken);
+
+
+Groups *new_groups(void)
+{
+	Groups *g = g_new0(Groups, 1);
+
+	g->groups = g_ptr_array_new_with_free_func(free_group);
+	g->reading = g_ptr_array_new();
+	return g;
+}
+
+
+void free_groups(Groups *g)
+{
+	g_ptr_array_free(g->groups, TRUE);
+	g_ptr_array_free(g->reading, TRUE);
+	g_free(g);
+}
+
+
+static void free_group(gpointer data)
+{
+	HostGroup *hg = data;
+
+	g_string_free(hg->name, TRUE);
+	free_bitset(hg->own);
+	free_bitset(hg->members);
+	g_free(hg);
+}
+
+
+/**
+ * @return the group for the list, or NULL if we have not read it
+ */
+HostGroup *find_group(Groups *g, const char *name)
+{
+	for (int i=0; i<g->groups->len; i++) {
+		HostGroup *hg = g_ptr_array_index(g->groups, i);
+		if (0 == strcmp(hg->name->str, name)) {
+			return hg;
+		}
+	}
+	return 0;
+}
+
+
+/**
+ * @return the group for the list, which is new if we have not read it
+ */
+HostGroup *get_group(Groups *g, const char *name)
+{
+	HostGroup *hg = find_group(g, name);
+
+	if (! hg) {
+		hg = g_new0(HostGroup, 1);
+		hg->name = g_string_new(name);
+		hg->own = new_bitset();
+		hg->members = new_bitset();
+		g_ptr_array_add(g->groups, hg);
+	}
+	return hg;
+}
+
+
+/**
+ * We are starting to read a list file, which may be inside another.
+ */
+void group_enter(Groups *g, const char *name)
+{
+	g_ptr_array_add(g->reading, get_group(g, name));
+}
+
+
+/**
+ * We have finished reading the innermost list file.
+ */
+void group_leave(Groups *g)
+{
+	g_ptr_array_set_size(g->reading, g->reading->len - 1);
+}
+
+
+/**
+ * A host was named in the list we are reading.  It is in that list, and so
+ * in every list that includes it.
+ */
+void group_add_host(Groups *g, HostId id)
+{
+	int n = g->reading->len;
+
+	if (! n) {
+		return;
+	}
+	bitset_add(((HostGroup *) g_ptr_array_index(g->reading, n-1))->own, id);
+	for (int i=0; i<n; i++) {
+		bitset_add(((HostGroup *) g_ptr_array_index(g->reading, i))
+			   ->members, id);
+	}
+}
+
+
+/**
+ * Run at most limit hosts from a list, and the lists it includes, at once.
+ */
+void set_group_limit(Groups *g, const char *name, int limit)
+{
+	get_group(g, name)->limit = limit;
+	g->limited = TRUE;
+}
+
+
+/**
+ * Run at most limit of the hosts named in any one list at once.
+ */
+void set_per_list_limit(Groups *g, int limit)
+{
+	g->per_list = limit;
+	g->limited = TRUE;
+}
+
+
+/**
+ * Count a host as running in each of its groups, if all of them have room
+ * for it.
+ *
+ * @return what the host took, to give back with groups_give(), or NULL if
+ * the host has to wait
+ */
+GPtrArray *groups_take(Groups *g, HostId id)
+{
+	GPtrArray *taken;
+
+	// Look first, so a host that has to wait changes nothing.
+	for (int i=0; i<g->groups->len; i++) {
+		if (! has_room(g, g_ptr_array_index(g->groups, i), id)) {
+			return 0;
+		}
+	}
+	taken = g_ptr_array_new();
+	for (int i=0; i<g->groups->len; i++) {
+		HostGroup *hg = g_ptr_array_index(g->groups, i);
+		if ((hg->limit && bitset_has(hg->members, id)
+		     && ! take_one(&hg->running, hg->limit, taken))
+		    || (g->per_list && bitset_has(hg->own, id)
+			&& ! take_one(&hg->running_own, g->per_list, taken))) {
+			// Another thread took the room first.  What we took
+			// may have turned a host away meanwhile, so this has
+			// to count as freeing room.
+			groups_give(g, taken);
+			return 0;
+		}
+	}
+	return taken;
+}
+
+
+/**
+ * A host that groups_take() counted has stopped running.
+ */
+void groups_give(Groups *g, GPtrArray *taken)
+{
+	for (int i=0; i<taken->len; i++) {
+		g_atomic_int_add((gint *) g_ptr_array_index(taken, i), -1);
+	}
+	if (taken->len) {
+		g_atomic_int_inc(&g->freed);
+	}
+	g_ptr_array_free(taken, TRUE);
+}
+
+
+/**
+ * Does a group have room for one more of the host's?
+ */
+static int has_room(Groups *g, HostGroup *hg, HostId id)
+{
+	if (hg->limit && bitset_has(hg->members, id)
+	    && g_atomic_int_get(&hg->running) >= hg->limit) {
+		return FALSE;
+	}
+	return ! (g->per_list && bitset_has(hg->own, id)
+		  && g_atomic_int_get(&hg->running_own) >= g->per_list);
+}
+
+
+/**
+ * Count one more in a group, if it has room.  Other threads can be doing the
+ * same, so we add first and take it back if that went over.
+ */
+static int take_one(gint *running, int limit, GPtrArray *taken)
+{
+	if (g_atomic_int_add(running, 1) < limit) {
+		g_ptr_array_add(taken, running);
+		return TRUE;
+	}
+	g_atomic_int_add(running, -1);
+	return FALSE;
+}
@@ -0,0 +1,54 @@
+#ifndef groups_h_INCLUDED
+#define groups_h_INCLUDED
+
+#include <glib.h>
+
+#include "bitset.h"
+#include "names.h"
+
+
+/**
+ * The hosts that came from one list file.  A list that includes another
+ * (with a "+file" line) has that list's hosts as members too.
+ */
+struct _hostGroup {
+	GString *name;		/* The list's file name, as it was given */
+	Bitset *own;		/* Hosts named in the list itself */
+	Bitset *members;	/* Those, and the hosts in lists it includes */
+	int limit;		/* --group-limit, or 0 */
+	gint running;		/* Members running now, if there's a limit */
+	gint running_own;	/* Own hosts running, for --per-list-limit */
+};
+typedef struct _hostGroup HostGroup;
+
+
+/**
+ * Every list file we have read hosts from, and how many of each list's hosts
+ * can run at once.  Runners share this, so the counts are atomic.
+ */
+struct _groups {
+	GPtrArray *groups;	/* HostGroup* */
+	GPtrArray *reading;	/* HostGroup*, the lists being read, outermost
+				   first */
+	int per_list;		/* --per-list-limit, or 0 */
+	int limited;		/* per_list, or some group has a limit */
+	gint freed;		/* Goes up as limited hosts finish */
+};
+typedef struct _groups Groups;
+
+
+// groups.c
+Groups *new_groups(void);
+void free_groups(Groups *g);
+HostGroup *find_group(Groups *g, const char *name);
+HostGroup *get_group(Groups *g, const char *name);
+void group_enter(Groups *g, const char *name);
+void group_leave(Groups *g);
+void group_add_host(Groups *g, HostId id);
+void set_group_limit(Groups *g, const char *name, int limit);
+void set_per_list_limit(Groups *g, int limit);
+GPtrArray *groups_take(Groups *g, HostId id);
+void groups_give(Groups *g, GPtrArray *taken);
+
+
+#endif // groups_h_INCLUDED
@@ -0,0 +1,111 @@
+/*
+ * Remember how long each host takes, so that slow hosts can be started
+ * first.  The file has one line for each host, "milliseconds host".  Each new
+ * time is averaged with the old one, so one odd run doesn't count for much.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "history.h"
+
+
+/**
+ * Read the history file.  A missing or unreadable file is an empty history.
+ */
+History *load_history(const char *filename)
+{
+	History *h = g_new0(History, 1);
+	gchar *contents;
+	gchar **lines;
+
+	h->filename = g_strdup(filename);
+	h->ms = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, 0);
+	if (! g_file_get_contents(filename, &contents, 0, 0)) {
+		return h;
+	}
+	lines = g_strsplit(contents, "\n", -1);
+	for (int i=0; lines[i]; i++) {
+		char host[256];
+		int ms;
+		if (2 == sscanf(lines[i], "%d %255s", &ms, host) && ms >= 0) {
+			g_hash_table_replace(h->ms, g_strdup(host),
+					     GINT_TO_POINTER(ms));
+		}
+	}
+	g_strfreev(lines);
+	g_free(contents);
+	return h;
+}
+
+
+/**
+ * @return how long the host usually takes in ms, or -1 if we don't know
+ */
+int history_get(History *h, const char *host)
+{
+	gpointer ms;
+
+	if (g_hash_table_lookup_extended(h->ms, host, 0, &ms)) {
+		return GPOINTER_TO_INT(ms);
+	}
+	return -1;
+}
+
+
+/**
+ * Add a new time for a host.
+ *
+ * @param usec how long the host took this time
+ */
+void history_record(History *h, const char *host, gint64 usec)
+{
+	int ms = (int) MIN(usec / 1000, G_MAXINT / 4);
+	int old = history_get(h, host);
+
+	if (old >= 0) {
+		ms = (3 * old + ms) / 4;
+	}
+	g_hash_table_replace(h->ms, g_strdup(host), GINT_TO_POINTER(ms));
+	h->changed = TRUE;
+}
+
+
+/**
+ * Write the history back, if it has changed.  The new file replaces the old
+ * one in one go, so a run that is killed part way doesn't lose it.
+ */
+void save_history(History *h)
+{
+	GHashTableIter iter;
+	gpointer host, ms;
+	GString *gs;
+	gchar *dir;
+
+	if (! h->changed) {
+		return;
+	}
+	gs = g_string_new("");
+	g_hash_table_iter_init(&iter, h->ms);
+	while (g_hash_table_iter_next(&iter, &host, &ms)) {
+		g_string_append_printf(gs, "%d %s\n", GPOINTER_TO_INT(ms),
+				       (char *) host);
+	}
+	dir = g_path_get_dirname(h->filename);
+	g_mkdir_with_parents(dir, 0700);
+	g_free(dir);
+	// The history is only a hint, so not being able to save it is fine.
+	g_file_set_contents(h->filename, gs->str, gs->len, 0);
+	g_string_free(gs, TRUE);
+	h->changed = FALSE;
+}
+
+
+void free_history(History *h)
+{
+	g_hash_table_destroy(h->ms);
+	g_free(h->filename);
+	g_free(h);
+}
@@ -0,0 +1,26 @@
+#ifndef history_h_INCLUDED
+#define history_h_INCLUDED
+
+#include <glib.h>
+
+
+/**
+ * How long each host took on recent runs, kept in a file between runs.
+ */
+struct _history {
+	gchar *filename;
+	GHashTable *ms;		/* Host name to milliseconds (GINT_TO_POINTER) */
+	int changed;		/* Something to save */
+};
+typedef struct _history History;
+
+
+// history.c
+History *load_history(const char *filename);
+int history_get(History *h, const char *host);
+void history_record(History *h, const char *host, gint64 usec);
+void save_history(History *h);
+void free_history(History *h);
+
+
+#endif // history_h_INCLUDED
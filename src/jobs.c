@@ -0,0 +1,148 @@
+/*
+ * Read a --jobs file, which gives each host its own command.  Each line is
+ * a host name, a tab, and the command, which the remote shell runs as it
+ * is.  Blank lines and lines starting with # are skipped.
+ */
+
+#define _GNU_SOURCE		/* getline() */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "for-all.h"
+#include "jobs.h"
+#include "lists.h"
+
+
+static void add_job(ForAll *fa, Jobs *j, const char *host, int hostlen,
+		    const char *command, int commandlen);
+
+
+/**
+ * Read the jobs, adding each host to the hosts list.  "-" reads stdin.
+ * Exits if the file cannot be read, or a line has no tab or a bad host name.
+ * The whole file is read before any host starts, as a host's later lines
+ * add to its steps.
+ */
+Jobs *read_jobs(ForAll *fa, const char *filename)
+{
+	Jobs *j = g_new0(Jobs, 1);
+	FILE *f;
+	char *line = 0;
+	size_t size = 0;
+	ssize_t len;
+	int lineno = 0;
+
+	j->text = g_string_new("");
+	j->jobs = g_array_new(FALSE, FALSE, sizeof(Job));
+	j->first = g_array_new(FALSE, FALSE, sizeof(guint32));
+	j->last = g_array_new(FALSE, FALSE, sizeof(guint32));
+	if (0 == strcmp(filename, "-")) {
+		f = stdin;
+	} else {
+		f = fopen(filename, "r");
+	}
+	if (! f) {
+		fprintf(stderr, "%s: Cannot open \"%s\": %s\n",
+			myname, filename, strerror(errno));
+		exit(3);
+	}
+	while (-1 != (len = getline(&line, &size, f))) {
+		char *tab;
+		char *host = line;
+		int hostlen;
+		lineno ++;
+		while (len && ('\n' == line[len-1] || '\r' == line[len-1])) {
+			line[--len] = '\0';
+		}
+		while (' ' == *host) {
+			host ++;
+		}
+		if (! *host || '#' == *host) {
+			continue;
+		}
+		tab = strchr(host, '\t');
+		if (! tab || tab == host) {
+			fprintf(stderr, "%s: %s:%d: need a host, a tab, "
+				"and a command\n", myname, filename, lineno);
+			exit(3);
+		}
+		hostlen = tab - host;
+		while (' ' == host[hostlen-1]) {
+			hostlen --;
+		}
+		// It goes on ssh's command line, so it must not look like an
+		// option.
+		if (! is_host_name(fa, host, hostlen)) {
+			fprintf(stderr, "%s: %s:%d: bad host name \"%.*s\"\n",
+				myname, filename, lineno, hostlen, host);
+			exit(3);
+		}
+		add_job(fa, j, host, hostlen, tab + 1,
+			len - (tab + 1 - line));
+	}
+	if (ferror(f)) {
+		fprintf(stderr, "%s: error reading %s: %s\n",
+			myname, filename, strerror(errno));
+		exit(3);
+	}
+	free(line);
+	if (stdin != f) {
+		fclose(f);
+	}
+	return j;
+}
+
+
+static void add_job(ForAll *fa, Jobs *j, const char *host, int hostlen,
+		    const char *command, int commandlen)
+{
+	HostId id = intern_name(fa->names, host, hostlen);
+	guint32 index = j->jobs->len;
+	guint32 none = NO_JOB;
+	Job job;
+
+	job.command = j->text->len;
+	job.next = NO_JOB;
+	g_string_append_len(j->text, command, commandlen);
+	g_string_append_c(j->text, '\0');
+	g_array_append_val(j->jobs, job);
+
+	while (j->first->len <= id) {
+		g_array_append_val(j->first, none);
+		g_array_append_val(j->last, none);
+	}
+	if (NO_JOB == g_array_index(j->first, guint32, id)) {
+		g_array_index(j->first, guint32, id) = index;
+		add_host(fa, name_of(fa->names, id));
+	} else {
+		guint32 last = g_array_index(j->last, guint32, id);
+		g_array_index(j->jobs, Job, last).next = index;
+	}
+	g_array_index(j->last, guint32, id) = index;
+}
+
+
+/**
+ * @return the host's first job, or NO_JOB if it has none
+ */
+guint32 first_job(Jobs *j, HostId id)
+{
+	return id < j->first->len ? g_array_index(j->first, guint32, id)
+		: NO_JOB;
+}
+
+
+guint32 next_job(Jobs *j, guint32 job)
+{
+	return g_array_index(j->jobs, Job, job).next;
+}
+
+
+const char *job_command(Jobs *j, guint32 job)
+{
+	return j->text->str + g_array_index(j->jobs, Job, job).command;
+}
@@ -0,0 +1,40 @@
+#ifndef jobs_h_INCLUDED
+#define jobs_h_INCLUDED
+
+#include <glib.h>
+
+#include "context.h"
+
+
+/** The end of a host's list of jobs. */
+#define NO_JOB G_MAXUINT32
+
+
+struct _job {
+	guint32 command;	/* Offset of the command in Jobs.text */
+	guint32 next;		/* The host's next job, or NO_JOB */
+};
+typedef struct _job Job;
+
+
+/**
+ * A command for each host, from --jobs.  A host with more than one job runs
+ * them in the order they were read.
+ */
+struct _jobs {
+	GString *text;		/* Every command, each ending with a NUL */
+	GArray *jobs;		/* Job */
+	GArray *first;		/* guint32, each host's first job, by HostId */
+	GArray *last;		/* guint32, each host's last job, by HostId */
+};
+typedef struct _jobs Jobs;
+
+
+// jobs.c
+Jobs *read_jobs(ForAll *fa, const char *filename);
+guint32 first_job(Jobs *j, HostId id);
+guint32 next_job(Jobs *j, guint32 job);
+const char *job_command(Jobs *j, guint32 job);
+
+
+#endif // jobs_h_INCLUDED
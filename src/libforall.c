@@ -0,0 +1,168 @@
+/*
+ * The public side of libforall: making a context, and running a command on
+ * its hosts with callbacks instead of RunOps.
+ */
+
+#include <glib.h>
+
+#include "libforall.h"
+#include "utils.h"
+
+
+/**
+ * A command submitted with forall_submit().
+ */
+struct _submission {
+	ForAll *fa;
+	Template *args;		/* ssh and the command */
+	ForAllCallbacks cb;
+	void *data;
+};
+typedef struct _submission Submission;
+
+
+static int submit_step(HostRun *hr, void *data);
+static void submit_output(HostRun *hr, const char *buf, int len, void *data);
+static void submit_done(HostRun *hr, void *data);
+static void free_submission(gpointer data);
+
+
+static RunOps submit_ops = {
+	submit_step,
+	submit_output,
+	submit_done,
+};
+
+
+/**
+ * Make a new context, using "ssh" to reach hosts.
+ *
+ * @param name to start error messages with, eg the program's name
+ */
+ForAll *new_forall(const char *name)
+{
+	ForAll *fa = g_new0(ForAll, 1);
+
+	fa->name = name;
+	init_lists(fa);
+	init_results(fa);
+	fa->ssh = g_string_new("ssh");
+	fa->ssh_options = g_ptr_array_new();
+	fa->mux_persist = g_string_new("ControlPersist=60");
+	fa->retry_backoff = 1000;
+	return fa;
+}
+
+
+/**
+ * Free a context.  The host names and results go with it, so no Runner can
+ * still be using it.
+ */
+void free_forall(ForAll *fa)
+{
+	g_array_free(fa->hosts, TRUE);
+	g_array_free(fa->nots, TRUE);
+	g_ptr_array_free(fa->host_lists, TRUE);
+	g_ptr_array_free(fa->not_host_lists, TRUE);
+	g_ptr_array_free(fa->not_dirs, TRUE);
+	free_groups(fa->groups);
+	free_results(fa);
+	free_names(fa->names);
+	g_string_free(fa->ssh, TRUE);
+	if (fa->user) {
+		g_string_free(fa->user, TRUE);
+	}
+	g_ptr_array_free(fa->ssh_options, TRUE);
+	g_string_free(fa->mux_persist, TRUE);
+	g_free(fa->adaptive);
+	g_free(fa->budget);
+	if (fa->history) {
+		free_history(fa->history);
+	}
+	if (fa->trace) {
+		free_trace(fa->trace);
+	}
+	if (fa->watch) {
+		free_list_watch(fa->watch);
+	}
+	g_free(fa);
+}
+
+
+/**
+ * Run a command on every host, in the order of the hosts list.
+ *
+ * @param parallel how many hosts to run at once
+ * @param command NULL terminated argv for the remote command
+ * @param cb called with each host's output and result
+ * @param data passed to the callbacks
+ * @return a Runner for the caller to drive, and free with free_runner()
+ */
+Runner *forall_submit(ForAll *fa, int parallel, char **command,
+		      ForAllCallbacks *cb, void *data)
+{
+	Submission *s = g_new0(Submission, 1);
+	GArray *order = g_array_sized_new(FALSE, FALSE, sizeof(int),
+					  n_hosts(fa));
+	Runner *r;
+
+	s->fa = fa;
+	s->args = ssh_template(fa, SSH_NO_STDIN | SSH_TTY);
+	for (int i=0; command[i]; i++) {
+		template_add_literal(s->args, command[i]);
+	}
+	s->cb = *cb;
+	s->data = data;
+	for (int i=0; i<n_hosts(fa); i++) {
+		g_array_append_val(order, i);
+	}
+	r = new_runner(fa, order, parallel, &submit_ops, s);
+	r->free_data = free_submission;
+	return r;
+}
+
+
+static int submit_step(HostRun *hr, void *data)
+{
+	Submission *s = (Submission *) data;
+
+	if (hr->step > 0) {
+		return FALSE;
+	}
+	host_args(s->fa, hr, s->args);
+	return TRUE;
+}
+
+
+static void submit_output(HostRun *hr, const char *buf, int len, void *data)
+{
+	Submission *s = (Submission *) data;
+
+	if (s->cb.output) {
+		s->cb.output(hr->host, buf, len, s->data);
+	}
+}
+
+
+/**
+ * The host goes on the success or failure list as usual, and the caller gets
+ * its wait() status, or -1 if the command could not be started.
+ */
+static void submit_done(HostRun *hr, void *data)
+{
+	Submission *s = (Submission *) data;
+
+	record_result(s->fa, hr, RESULT_OK);
+	if (s->cb.done) {
+		s->cb.done(hr->host, hr->status, s->data);
+	}
+}
+
+
+static void free_submission(gpointer data)
+{
+	Submission *s = (Submission *) data;
+
+	free_template(s->args);
+	g_free(s);
+}
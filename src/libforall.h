@@ -0,0 +1,39 @@
+#ifndef libforall_h_INCLUDED
+#define libforall_h_INCLUDED
+
+/**
+ * Run commands on lists of hosts from another program.
+ *
+ * Make a ForAll with new_forall(), give it hosts with add_host() and
+ * add_list() (see lists.h), call process_lists(), then forall_submit() a
+ * command.  Drive the returned Runner with runner_iterate(), or poll its
+ * runner_pollfds() from your own event loop.  The callbacks get each host's
+ * output as it arrives, and its wait() status when it is done.
+ */
+
+#include <glib.h>
+
+#include "context.h"
+#include "lists.h"
+#include "results.h"
+#include "run-command.h"
+
+
+/**
+ * What to do with each host's output and result.  Either can be NULL.
+ */
+struct _forAllCallbacks {
+	void (*output)(const char *host, const char *buf, int len, void *data);
+	void (*done)(const char *host, int status, void *data);
+};
+typedef struct _forAllCallbacks ForAllCallbacks;
+
+
+// libforall.c
+ForAll *new_forall(const char *name);
+void free_forall(ForAll *fa);
+Runner *forall_submit(ForAll *fa, int parallel, char **command,
+		      ForAllCallbacks *cb, void *data);
+
+
+#endif // libforall_h_INCLUDED
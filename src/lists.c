@@ -7,57 +7,59 @@
 #include <assert.h>
 #include <regex.h>
 
-#include "for-all.h"
 
+/** Flags on a name, for which lists it is in. */
+#define ON_HOSTS 0x01
+#define ON_NOTS  0x02
 
-GPtrArray *hosts;
-GPtrArray *nots;
 
-GPtrArray *host_lists;
-GPtrArray *not_host_lists;
-static GPtrArray * success_hosts;	   /* List of successes */
-static GPtrArray * failure_hosts;	   /* List of failures */
+static void add_to(ForAll *fa, GArray *list, guint8 flag, HostId id);
+static void keep_hosts(ForAll *fa, int from, int shard, int nshards);
+static int name_width(const char *name);
+static HostId line_to_host(ForAll *fa, char *line, int intern);
+static GString *line_to_file(ForAll *fa, char *line);
+static int list_host(ForAll *fa, GArray *list, guint8 flag, Bitset *set,
+		     const char *name);
+static void list_include(ForAll *fa, GArray *list, guint8 flag, Bitset *set,
+			 GString *filename);
+static int read_one_list(ForAll *fa, GArray *list, guint8 flag,
+			 HostListName *hln, Bitset *set);
+static int line_host_match(ForAll *fa, char *line, char **name, int *namelen);
+static int line_file_match(ForAll *fa, char *line, char **name, int *namelen);
+static ListFile * open_file_list(ForAll *fa, HostListName *hln, int *owned);
+static ListFile * open_one_list(ForAll *fa, const char *pathname, int *owned);
+static void note_not_dir(ForAll *fa, HostListName *hln);
 
 
-static void hosts_remove(gpointer x);
-static GString *line_to_host(char *line);
-static GString *line_to_file(char *line);
-static int line_host_match(char *line, char **name, int *namelen);
-static int line_file_match(char *line, char **name, int *namelen);
-static int in_list(GPtrArray *a, GString *h);
-static FILE * open_file_list(HostListName *hln);
 
-
-
-void init_lists(void)
+/**
+ * Set up the lists in a new context.
+ */
+void init_lists(ForAll *fa)
 {
-	hosts = g_ptr_array_new();
-	g_ptr_array_set_free_func(hosts, hosts_remove);
-	nots = g_ptr_array_new();
-	host_lists = g_ptr_array_new();
-	not_host_lists = g_ptr_array_new();
-	success_hosts = g_ptr_array_new();
-	failure_hosts = g_ptr_array_new();
+	fa->names = new_names();
+	fa->hosts = g_array_new(FALSE, FALSE, sizeof(HostId));
+	fa->nots = g_array_new(FALSE, FALSE, sizeof(HostId));
+	fa->host_lists = g_ptr_array_new_with_free_func(
+		(GDestroyNotify) free_hostlistname);
+	fa->not_host_lists = g_ptr_array_new_with_free_func(
+		(GDestroyNotify) free_hostlistname);
+	fa->not_dirs = g_ptr_array_new_with_free_func(g_free);
+	fa->groups = new_groups();
 }
 
 
 /** How many hosts do we have? */
-int n_hosts          (void) { return                  hosts->len; }
+int n_hosts          (ForAll *fa) { return              fa->hosts->len; }
 
 /** How many not hosts do we have? */
-int n_not_hosts      (void) { return                   nots->len; }
+int n_not_hosts      (ForAll *fa) { return               fa->nots->len; }
 
 /** How many hosts lists do we have? */
-int n_host_lists     (void) { return             host_lists->len; }
+int n_host_lists     (ForAll *fa) { return         fa->host_lists->len; }
 
 /** How many not hosts lists do we have? */
-int n_not_host_lists (void) { return         not_host_lists->len; }
-
-/** How many successful hosts do we have? */
-int n_successes      (void) { return          success_hosts->len; }
-
-/** How many successful hosts do we have? */
-int n_failures       (void) { return          failure_hosts->len; }
+int n_not_host_lists (ForAll *fa) { return     fa->not_host_lists->len; }
 
 
 /**
@@ -65,78 +67,69 @@ int n_failures       (void) { return          failure_hosts->len; }
  * to get the maximum index.
  *
  * @param i index of the host.
- * @return pointer to a host name
+ * @return the host name, which lasts as long as the context
  * @see n_hosts()
  */
-GString *get_host(int i)
+const char *get_host(ForAll *fa, int i)
 {
-	assert(i >= 0);
-	assert(i < hosts->len);
-	return (GString*) g_ptr_array_index(hosts, i);
+	return name_of(fa->names, get_host_id(fa, i));
 }
 
 
 /**
- * Get one host name from the not hosts list.  Caller should call n_not_hosts()
- * first to get the maximum index.
+ * Get the id of one host in the hosts list.
  *
- * @param i index of the host.
- * @return pointer to a host name
- * @see n_not_hosts()
+ * @see get_host()
  */
-GString *get_not_host(int i)
-{
-	assert(i >= 0);
-	assert(i < nots->len);
-	return (GString*) g_ptr_array_index(nots, i);
-}
-
-
-HostListName *get_host_list(int i)
+HostId get_host_id(ForAll *fa, int i)
 {
 	assert(i >= 0);
-	assert(i < host_lists->len);
-	return (HostListName*) g_ptr_array_index(host_lists, i);
+	assert(i < fa->hosts->len);
+	return g_array_index(fa->hosts, HostId, i);
 }
 
 
-HostListName *get_not_host_list(int i)
+/**
+ * Get one host name from the not hosts list.  Caller should call n_not_hosts()
+ * first to get the maximum index.
+ *
+ * @param i index of the host.
+ * @return the host name
+ * @see n_not_hosts()
+ */
+const char *get_not_host(ForAll *fa, int i)
 {
 	assert(i >= 0);
-	assert(i < not_host_lists->len);
-	return (HostListName*) g_ptr_array_index(not_host_lists, i);
+	assert(i < fa->nots->len);
+	return name_of(fa->names, g_array_index(fa->nots, HostId, i));
 }
 
 
-GString *get_success(int i)
+HostListName *get_host_list(ForAll *fa, int i)
 {
 	assert(i >= 0);
-	assert(i < success_hosts->len);
-	return (GString*) g_ptr_array_index(success_hosts, i);
+	assert(i < fa->host_lists->len);
+	return (HostListName*) g_ptr_array_index(fa->host_lists, i);
 }
 
 
-GString *get_failure(int i)
+HostListName *get_not_host_list(ForAll *fa, int i)
 {
 	assert(i >= 0);
-	assert(i < failure_hosts->len);
-	return (GString*) g_ptr_array_index(failure_hosts, i);
+	assert(i < fa->not_host_lists->len);
+	return (HostListName*) g_ptr_array_index(fa->not_host_lists, i);
 }
 
 
 /**
  * Add a host name to the hosts list, if the host name is not already in the
- * list.  We own the GString* here, so need to free it if it's not used.
+ * list.
  *
  * @param host the host name to add
  */
-void add_host(GString *host)
+void add_host(ForAll *fa, const char *host)
 {
-	if (! in_list(hosts, host)) {
-		g_ptr_array_add(hosts, host);
-	} else {
-		g_string_free(host, TRUE);
-	}
+	add_to(fa, fa->hosts, ON_HOSTS, intern_name(fa->names, host, -1));
 }
 
 
@@ -145,51 +138,65 @@ void add_host(GString *host)
  *
  * @see add_host()
  */
-void add_not_host(GString *host)
+void add_not_host(ForAll *fa, const char *host)
 {
-	if (! in_list(nots, host)) {
-		g_ptr_array_add(nots, host);
-	} else {
-		g_string_free(host, TRUE);
+	add_to(fa, fa->nots, ON_NOTS, intern_name(fa->names, host, -1));
+}
+
+
+/**
+ * Add a host to the hosts or not hosts list, unless the flag on its name
+ * says it's there already.
+ */
+static void add_to(ForAll *fa, GArray *list, guint8 flag, HostId id)
+{
+	guint8 *flags = name_flags(fa->names, id);
+
+	if (! (*flags & flag)) {
+		*flags |= flag;
+		g_array_append_val(list, id);
+		// Hosts from -H - come in after the width is known.
+		if (fa->host_len && list == fa->hosts) {
+			fa->host_len = MAX(fa->host_len,
+					   name_width(name_of(fa->names, id)));
+		}
 	}
 }
 
 
 /**
  * Given a line of text, see if it matches a host name specification.  This
- * function is here to do the GString creation - regex matching is done by
+ * function is here to do the interning - regex matching is done by
  * line_host_match().
  *
  * @param line the text to scan for a host name.
+ * @param intern FALSE to only look for names we know already
  *
- * @return a newly allocated GString if a host name is found, or NULL if not
- * host name is found.
+ * @return the id of the host name, or NO_HOST if no host name is found.
  *
  * @see line_host_match()
  */
-static GString *line_to_host(char *line)
+static HostId line_to_host(ForAll *fa, char *line, int intern)
 {
-	GString *gs = 0;
-	int matched;
 	char *name;
 	int namelen;
 
-	matched = line_host_match(line, &name, &namelen);
-	if (matched) {
-		gs = g_string_new_len(name, namelen);
+	if (line_host_match(fa, line, &name, &namelen)) {
+		return intern ? intern_name(fa->names, name, namelen)
+			: find_name(fa->names, name, namelen);
 	}
-	return gs;
+	return NO_HOST;
 }
 
 
-static GString *line_to_file(char *line)
+static GString *line_to_file(ForAll *fa, char *line)
 {
 	GString *gs = 0;
 	int matched;
 	char *name;
 	int namelen;
 
-	matched = line_file_match(line, &name, &namelen);
+	matched = line_file_match(fa, line, &name, &namelen);
 	if (matched) {
 		gs = g_string_new_len(name, namelen);
 	}
@@ -197,6 +204,58 @@ static GString *line_to_file(char *line)
 }
 
 
+/**
+ * Add one host name from a list file to the list, or to the set.
+ *
+ * @return 1 if the name counts as read, else 0
+ * @see read_one_list()
+ */
+static int list_host(ForAll *fa, GArray *list, guint8 flag, Bitset *set,
+		     const char *name)
+{
+	HostId id;
+
+	// For a set of not hosts, only names we know already matter.
+	if (! set || ON_HOSTS == flag) {
+		id = intern_name(fa->names, name, -1);
+	} else {
+		id = find_name(fa->names, name, -1);
+	}
+	if (NO_HOST == id) {
+		return 0;
+	}
+	if (ON_HOSTS == flag) {
+		group_add_host(fa->groups, id);
+	}
+	if (set) {
+		bitset_add(set, id);
+	} else {
+		add_to(fa, list, flag, id);
+	}
+	return 1;
+}
+
+
+/**
+ * Follow a "+" line in a list file.  We own filename here.
+ *
+ * @see read_one_list()
+ */
+static void list_include(ForAll *fa, GArray *list, guint8 flag, Bitset *set,
+			 GString *filename)
+{
+	if (set) {
+		HostListName *inc = new_hostlistname(filename);
+		read_one_list(fa, list, flag, inc, set);
+		free_hostlistname(inc);
+	} else if (ON_NOTS == flag) {
+		add_not_list(fa, filename);
+	} else {
+		add_list(fa, filename);
+	}
+}
+
+
 /**
  * Match a line with a regex, looking for a host name.
  *
@@ -213,7 +272,7 @@ static GString *line_to_file(char *line)
  *
  * @return true if a match was found, 0 otherwise.
  */
-static int line_host_match(char *line, char **name, int *namelen)
+static int line_host_match(ForAll *fa, char *line, char **name, int *namelen)
 {
 	static int compiled = 0;
 	static regex_t reg;
@@ -231,7 +290,7 @@ static int line_host_match(char *line, char **name, int *namelen)
 			char errbuf[256];
 			regerror(regret, &reg, errbuf, 256);
 			fprintf(stderr, "%s: Cannot compile \"%s\": %s\n",
-				myname,
+				fa->name,
 				lineregex, errbuf);
 			exit(3);
 		}
@@ -246,13 +305,34 @@ static int line_host_match(char *line, char **name, int *namelen)
 		return 0;
 	}
 	off = matches[1].rm_so;
-	len = matches[1].rm_eo;
+	len = matches[1].rm_eo - matches[1].rm_so;
 	*name = line + off;
 	*namelen = len;
 	return TRUE;
 }
 
 
+/**
+ * Is this the whole of a host name, as a list file would have it?  Names that
+ * don't come from a list can use this to keep out names such as "-oFoo",
+ * which ssh would take as an option.
+ *
+ * @param len the length of name, which need not be terminated
+ */
+int is_host_name(ForAll *fa, const char *name, int len)
+{
+	gchar *copy = g_strndup(name, len);
+	char *start;
+	int namelen;
+	int ok;
+
+	ok = line_host_match(fa, copy, &start, &namelen)
+		&& start == copy && namelen == len;
+	g_free(copy);
+	return ok;
+}
+
+
 /**
  * Match a line with a regex, looking for a + and a file name.
  *
@@ -270,7 +350,7 @@ static int line_host_match(char *line, char **name, int *namelen)
  *
  * @return true if a match was found, 0 otherwise.
  */
-static int line_file_match(char *line, char **name, int *namelen)
+static int line_file_match(ForAll *fa, char *line, char **name, int *namelen)
 {
 	static int compiled = 0;
 	static regex_t reg;
@@ -288,7 +368,7 @@ static int line_file_match(char *line, char **name, int *namelen)
 			char errbuf[256];
 			regerror(regret, &reg, errbuf, 256);
 			fprintf(stderr, "%s: Cannot compile \"%s\": %s\n",
-				myname,
+				fa->name,
 				lineregex, errbuf);
 			exit(3);
 		}
@@ -317,93 +397,159 @@ static int line_file_match(char *line, char **name, int *namelen)
  * we return TRUE.
  *
  * @param list the list to keep hosts specified in this file
+ * @param flag ON_HOSTS or ON_NOTS, to match the list
  * @param filename the file name of the list to read
+ * @param set if not NULL, the hosts go in here instead of list, along with
+ * the hosts of the lists that this one includes.  For ON_NOTS, only hosts we
+ * know already go in, as the names can't change while hosts run
  * @return the number of host names read
  * @see line_host_match(char*,char**,int*)
  */
-static int read_one_list(GPtrArray *list, HostListName *hln)
+static int read_one_list(ForAll *fa, GArray *list, guint8 flag,
+			 HostListName *hln, Bitset *set)
 {
-	FILE *f;
-	char *data = 0;
-	size_t size = 0;
+	ListFile *lf;
+	int owned;
+	int inc = 0;
 	int names_read = 0;
 
 	/* Only allow file lists to nest so far. */
-	static int nfiles = 0;
-
-	nfiles ++;
-	if (nfiles >= 5) {
+	if (fa->list_depth >= 5) {
 		fprintf(stderr, "%s: File lists nest too deep: \"%s\"\n",
-			myname, hln->filename->str);
+			fa->name, hln->filename->str);
+		// Hosts are running, so keep going without the change.
+		if (fa->rereading) {
+			fa->reread_failed = TRUE;
+			return 0;
+		}
 		exit(5);
 	}
 
-	f = open_file_list(hln);
-	if (0 == f) {
+	lf = open_file_list(fa, hln, &owned);
+	if (0 == lf) {
+		// Eg an editor is part way through renaming it into place.
+		if (fa->rereading) {
+			fa->reread_failed = TRUE;
+			return 0;
+		}
 		fprintf(stderr, "Cannot open \"%s\": %s\n", hln->filename->str,
 			strerror(errno));
 		return 0;
 	}
+	fa->list_depth ++;
+	if (ON_HOSTS == flag) {
+		group_enter(fa->groups, hln->filename->str);
+	} else {
+		note_not_dir(fa, hln);
+	}
+	for (int i=0; i<lf->hosts->len; i++) {
+		const char *name = g_ptr_array_index(lf->hosts, i);
+		if (name) {
+			names_read += list_host(fa, list, flag, set, name);
+		} else {
+			name = g_ptr_array_index(lf->includes, inc++);
+			list_include(fa, list, flag, set, g_string_new(name));
+		}
+	}
+	if (owned) {
+		free_list_file(lf);
+	}
+	if (ON_HOSTS == flag) {
+		group_leave(fa->groups);
+	}
+	fa->list_depth --;
+	return names_read;
+}
 
 
+/**
+ * Read and parse a list file.  The includes are left as names, as where they
+ * are depends on the current directory of whoever reads the list.
+ *
+ * @param pathname where the file is
+ * @return a new ListFile, or NULL if the file can't be opened
+ * @see line_host_match(char*,char**,int*)
+ */
+ListFile *read_list_file(ForAll *fa, const char *pathname)
+{
+	ListFile *lf;
+	FILE *f;
+	char *data;
+	size_t size;
+
+	f = fopen(pathname, "r");
+	if (0 == f) {
+		return 0;
+	}
+	lf = g_new0(ListFile, 1);
+	lf->text = g_string_chunk_new(1024);
+	lf->hosts = g_ptr_array_new();
+	lf->includes = g_ptr_array_new();
+
 	size = 256;
 	data = malloc(size);
 	while (1) {
 		ssize_t ret;
+		char *name;
+		int namelen;
+
 		ret = getline(&data, &size, f);
 		if (-1 == ret) {
 			// getline() returns -1 on error, and also on EOF.
 			int err = errno;
 			if (!feof(f)) {
 				fprintf(stderr, "error reading %s: %s\n",
-					hln->filename->str, strerror(err));
+					pathname, strerror(err));
 			}
 			break;
 		}
-		//printf("Line: <<<%s>>>\n", data);
-		do {
-			GString *gs;
-
-			gs = line_to_host(data);
-			if (gs) {
-				if (in_list(list, gs)) {
-					//printf("Nooooo %s from %s\n", gs->str, filename->str);
-					g_string_free(gs, TRUE);
-				} else {
-					//printf("adding %s from %s\n", gs->str, filename->str);
-					// gs is newly allocated, and the host list
-					// takes over ownership.
-					g_ptr_array_add(list, gs);
-				}
-				names_read ++;
-				break;
-			}
-			gs = line_to_file(data);
-			if (gs) {
-				add_list(gs);
-			}
-		} while (0);
+		if (line_host_match(fa, data, &name, &namelen)) {
+			g_ptr_array_add(lf->hosts, g_string_chunk_insert_len(
+						lf->text, name, namelen));
+		} else if (line_file_match(fa, data, &name, &namelen)) {
+			// NULL marks where the include goes.
+			g_ptr_array_add(lf->hosts, NULL);
+			g_ptr_array_add(lf->includes, g_string_chunk_insert_len(
+						lf->text, name, namelen));
+		}
 	}
 	free(data);
 	fclose(f);
-	return names_read;
+	return lf;
 }
 
 
-static FILE * open_file_list(HostListName *hln)
+void free_list_file(ListFile *lf)
 {
-	FILE *f;
+	g_ptr_array_free(lf->hosts, TRUE);
+	g_ptr_array_free(lf->includes, TRUE);
+	g_string_chunk_free(lf->text);
+	g_free(lf);
+}
+
+
+/**
+ * Find a list file where it might be, and read it.
+ *
+ * @param owned set to TRUE if the caller should free the ListFile, FALSE if
+ * it came from the cache
+ * @return the parsed list, or NULL if there's no such list
+ */
+static ListFile * open_file_list(ForAll *fa, HostListName *hln, int *owned)
+{
+	ListFile *lf;
 	char *home;
 
 	/* Try the plain file name first. */
-	f = fopen(hln->filename->str, "r");
-	if (0 !=f ) {
-		g_string_printf(hln->pathname, "%s", hln->filename->str);
-		return f;
+	g_string_printf(hln->pathname, "%s", hln->filename->str);
+	lf = open_one_list(fa, hln->pathname->str, owned);
+	if (lf) {
+		return lf;
 	}
 
 	/* If the file name has a '/' in it, don't do any more searching. */
 	if (strchr(hln->filename->str, '/')) {
+		g_string_erase(hln->pathname, 0, -1);
 		return 0;
 	}
 
@@ -412,17 +558,17 @@ static FILE * open_file_list(HostListName *hln)
 	if (home) {
 		g_string_printf(hln->pathname, "%s/etc/for-all/%s",
 				home, hln->filename->str);
-		f = fopen(hln->pathname->str, "r");
-		if (f) {
-			return f;
+		lf = open_one_list(fa, hln->pathname->str, owned);
+		if (lf) {
+			return lf;
 		}
 	}
 
 	/* Now just /etc/for-all/<filename> */
 	g_string_printf(hln->pathname, "/etc/for-all/%s", hln->filename->str);
-	f = fopen(hln->pathname->str, "r");
-	if (f) {
-		return f;
+	lf = open_one_list(fa, hln->pathname->str, owned);
+	if (lf) {
+		return lf;
 	}
 
 	/* No file found. */
@@ -431,19 +577,77 @@ static FILE * open_file_list(HostListName *hln)
 }
 
 
+/**
+ * The directories that list files are looked for in, after the current
+ * directory.  These are the same as open_file_list() uses.
+ *
+ * @return a new NULL terminated array, to free with g_strfreev()
+ */
+gchar **list_dirs(void)
+{
+	gchar **dirs = g_new0(gchar *, 3);
+	int n = 0;
+	char *home = getenv("HOME");
+
+	if (home) {
+		dirs[n++] = g_strdup_printf("%s/etc/for-all", home);
+	}
+	dirs[n++] = g_strdup("/etc/for-all");
+	return dirs;
+}
+
+
+/**
+ * Read a list file, or take it from the cache if we have one (eg in the
+ * daemon).  The cache goes by absolute pathname.
+ */
+static ListFile * open_one_list(ForAll *fa, const char *pathname, int *owned)
+{
+	ListFile *lf = 0;
+
+	if (fa->list_cache) {
+		gchar *key = list_cache_key(pathname);
+		lf = g_hash_table_lookup(fa->list_cache, key);
+		g_free(key);
+	}
+	*owned = ! lf;
+	return lf ? lf : read_list_file(fa, pathname);
+}
+
+
+/**
+ * The list cache's key for a list file, which is its pathname made absolute.
+ *
+ * @return a new string
+ */
+gchar *list_cache_key(const char *pathname)
+{
+	gchar *cwd;
+	gchar *key;
+
+	if (g_path_is_absolute(pathname)) {
+		return g_strdup(pathname);
+	}
+	cwd = g_get_current_dir();
+	key = g_build_filename(cwd, pathname, NULL);
+	g_free(cwd);
+	return key;
+}
+
+
 /**
  * Read host names from a list file.  If any host names are read successfully,
  * we save the file name on our list of host lists.
  *
  * @param filename name of the file to read host names from
  */
-void add_list(GString *filename)
+void add_list(ForAll *fa, GString *filename)
 {
 	HostListName *hln = new_hostlistname(filename);
 
-	if (read_one_list(hosts, hln)) {
+	if (read_one_list(fa, fa->hosts, ON_HOSTS, hln, 0)) {
 		// We own the list here.
-		g_ptr_array_add(host_lists, hln);
+		g_ptr_array_add(fa->host_lists, hln);
 	} else {
 		free_hostlistname(hln);
 	}
@@ -453,144 +657,278 @@ void add_list(GString *filename)
 /**
  * @see add_list()
  */
-void add_not_list(GString *filename)
+void add_not_list(ForAll *fa, GString *filename)
 {
 	HostListName *hln = new_hostlistname(filename);
 
-	if (read_one_list(nots, hln)) {
-		g_ptr_array_add(not_host_lists, hln);
+	if (read_one_list(fa, fa->nots, ON_NOTS, hln, 0)) {
+		g_ptr_array_add(fa->not_host_lists, hln);
 	} else {
 		free_hostlistname(hln);
 	}
 }
 
 
+/**
+ * Read the hosts from a list file, and the lists it includes, into a set
+ * without adding them to the hosts list.  A list that can't be read is
+ * empty, as it is with add_list().
+ *
+ * @return a new Bitset
+ */
+Bitset *read_list_set(ForAll *fa, const char *filename)
+{
+	HostListName *hln = new_hostlistname(g_string_new(filename));
+	Bitset *set = new_bitset();
+
+	read_one_list(fa, 0, ON_HOSTS, hln, set);
+	free_hostlistname(hln);
+	return set;
+}
+
+
+/**
+ * Add each host in a set to the hosts list, in the order of their ids,
+ * which is the order they were first seen in.
+ */
+void add_host_set(ForAll *fa, Bitset *set)
+{
+	for (HostId id=bitset_next(set, 0); NO_HOST != id;
+	     id=bitset_next(set, id + 1)) {
+		add_to(fa, fa->hosts, ON_HOSTS, id);
+	}
+}
+
+
+/**
+ * Remember the directory a -N list, or a list it includes, was found in.
+ * Once the lists are watched, a list found somewhere new, eg one that an
+ * edit has just included, is watched from then on.
+ */
+static void note_not_dir(ForAll *fa, HostListName *hln)
+{
+	gchar *dir;
+
+	if (! hln->pathname->len) {
+		return;
+	}
+	dir = g_path_get_dirname(hln->pathname->str);
+	for (int i=0; i<fa->not_dirs->len; i++) {
+		if (0 == strcmp(dir, g_ptr_array_index(fa->not_dirs, i))) {
+			g_free(dir);
+			return;
+		}
+	}
+	g_ptr_array_add(fa->not_dirs, dir);
+	if (fa->watch) {
+		watch_list_dir(fa->watch, dir);
+	}
+}
+
+
+/**
+ * Watch the directories that the -N lists, and the lists they include, came
+ * from, so that check_not_lists() can see when the lists change during the
+ * run.
+ */
+void watch_not_lists(ForAll *fa)
+{
+	if (fa->not_dirs->len) {
+		fa->watch = new_list_watch();
+	}
+	for (int i=0; fa->watch && i<fa->not_dirs->len; i++) {
+		watch_list_dir(fa->watch, g_ptr_array_index(fa->not_dirs, i));
+	}
+	if (fa->watch) {
+		// So that only hosts excluded from now on count as more.
+		Bitset *set = new_bitset();
+		for (int i=0; i<fa->nots->len; i++) {
+			bitset_add(set, g_array_index(fa->nots, HostId, i));
+		}
+		watch_add(fa->watch, set);
+		free_bitset(set);
+	}
+}
+
+
+/**
+ * If anything changed where the -N lists are, read them again, so that
+ * Runners skip any host the lists exclude now that hasn't started yet.  If a
+ * list can't be read, or now nests too deep, the hosts excluded so far stay
+ * as they are, until the next change.
+ */
+void check_not_lists(ForAll *fa)
+{
+	GHashTable *cache = fa->list_cache;
+	Bitset *set;
+	int added;
+
+	if (! fa->watch || ! watch_changed(fa->watch)) {
+		return;
+	}
+	// The daemon's copies of the lists are as old as the run.
+	fa->list_cache = 0;
+	fa->rereading = TRUE;
+	fa->reread_failed = FALSE;
+	set = new_bitset();
+	for (int i=0; i<n_not_host_lists(fa); i++) {
+		read_one_list(fa, 0, ON_NOTS, get_not_host_list(fa, i), set);
+	}
+	fa->list_cache = cache;
+	fa->rereading = FALSE;
+	if (fa->reread_failed) {
+		free_bitset(set);
+		return;
+	}
+	added = watch_add(fa->watch, set);
+	free_bitset(set);
+	if (fa->debug && added) {
+		fprintf(stderr, "%s: the -N lists exclude %d more hosts\n",
+			fa->name, added);
+	}
+}
+
+
 /**
  * Compare two hosts by name.
  *
  * @return an int indicating the order
  * @see strcmp(3)
  */
-int compare_hosts(gconstpointer a, gconstpointer b)
+static gint compare_hosts(gconstpointer a, gconstpointer b, gpointer data)
 {
-	const GString *ga = *((GString **) a);
-	const GString *gb = *((GString **) b);
-	return strcmp(ga->str, gb->str);
+	Names *names = data;
+	return strcmp(name_of(names, *(const HostId *) a),
+		      name_of(names, *(const HostId *) b));
 }
 
 
 /**
  * Sort the lists in place.
  */
-void sort_hosts(void)
+void sort_hosts(ForAll *fa)
 {
-	g_ptr_array_sort(hosts, compare_hosts);
-	g_ptr_array_sort(nots, compare_hosts);
+	g_array_sort_with_data(fa->hosts, compare_hosts, fa->names);
+	g_array_sort_with_data(fa->nots, compare_hosts, fa->names);
 }
 
 
 /**
  * Remove hosts from the hosts list, that are also in the not list.
  */
-void process_lists(void)
+void process_lists(ForAll *fa)
 {
-	for (int i=0; i<hosts->len; i++) {
-		if (in_list(nots, (GString*) g_ptr_array_index(hosts, i))) {
-			g_ptr_array_remove_index(hosts, i);
-			i--;
-		}
-	}
+	keep_hosts(fa, 0, 0, 0);
 }
 
 
 /**
- * Called when we remove a string from the hosts list.
- *
- * The hosts list owns the GStrings, so we want to deallocate them.  This is
- * called after we process all the host names and lists, so we can remove hosts
- * from the list of hosts to contact.
+ * Keep only the hosts in one shard of N.  Which shard a host is in depends
+ * only on its name, so N separate runs over the same list take disjoint
+ * sets of hosts, and adding a host to the list doesn't move any others.
  *
- * @param x the GString that is being removed.
+ * @param shard which shard to keep, from 1 to nshards
+ * @param nshards how many shards there are
  */
-static void hosts_remove(gpointer x)
+void shard_hosts(ForAll *fa, int shard, int nshards)
 {
-	GString *gs = (GString *) x;
-	g_string_free(gs, TRUE);
+	keep_hosts(fa, 0, shard, nshards);
 }
 
 
 /**
- * Is a host in an array?
+ * Add the host on one line of a host list that is still arriving, eg from
+ * stdin with -H -, so that it can be run straight away.  A host that is
+ * already listed, or is in the not list (which must be complete by now), or
+ * is in another shard, is ignored.  A "+file" line adds the hosts in that
+ * list in the same way.
  *
- * So we can remove hosts that are in the not list, from the hosts list.
- *
- * @param a array of host names
- * @param h host name
+ * @param line one line, which is changed
+ * @param shard which shard to keep, or 0 to keep every host
+ * @return how many hosts were added, at the end of the hosts list
  */
-static int in_list(GPtrArray *a, GString *h)
+int add_host_line(ForAll *fa, char *line, int shard, int nshards)
 {
-	for (int i=0; i<a->len; i++) {
-		if (g_string_equal(h, (GString*)g_ptr_array_index(a,i))) {
-			return TRUE;
+	int before = fa->hosts->len;
+	HostId id = line_to_host(fa, line, TRUE);
+
+	if (NO_HOST != id) {
+		add_to(fa, fa->hosts, ON_HOSTS, id);
+	} else {
+		GString *gs = line_to_file(fa, line);
+		if (gs) {
+			add_list(fa, gs);
 		}
 	}
-	return FALSE;
+	keep_hosts(fa, before, shard, nshards);
+	return fa->hosts->len - before;
 }
 
 
-int hosts_name_length(void)
+/**
+ * Take hosts out of the hosts list if they are in the not list, or in the
+ * wrong shard.
+ *
+ * @param from where in the hosts list to start
+ * @param shard which shard to keep, or 0 to keep every host
+ */
+static void keep_hosts(ForAll *fa, int from, int shard, int nshards)
 {
-	int namelen = 0;
-	for (int i=0; i<hosts->len; i++) {
-		GString *gs = (GString*) g_ptr_array_index(hosts, i);
-		if(gs->len > namelen) {
-			namelen = gs->len;
+	int n = from;
+
+	for (int i=from; i<fa->hosts->len; i++) {
+		HostId id = get_host_id(fa, i);
+		guint8 *flags = name_flags(fa->names, id);
+		if ((*flags & ON_NOTS) || (shard && name_hash(fa->names, id)
+					   % nshards != shard - 1)) {
+			*flags &= ~ON_HOSTS;
+		} else {
+			g_array_index(fa->hosts, HostId, n++) = id;
 		}
 	}
-	namelen += 8;
-	namelen -= (namelen % 8);
-	return namelen;
+	if (n < fa->hosts->len) {
+		// The longest name may have gone.
+		fa->host_len = 0;
+	}
+	g_array_set_size(fa->hosts, n);
 }
 
 
 /**
- * A host command run failed.  Record that on a list.
+ * @see host_len()
  */
-void failure(GString *s)
+int hosts_name_length(ForAll *fa)
 {
-	g_ptr_array_add(failure_hosts, s);
+	return host_len(fa);
 }
 
 
 /**
- * A host command run succeeded.  Record that on a list.
- *
- * @see failure()
+ * Calculate the field width needed for host names. The width is the smallest
+ * multiple of eight that is long enough for every host name.  It is worked
+ * out once, then widened as longer names are added, eg by -H -.
  */
-void success(GString *s)
+int host_len(ForAll *fa)
 {
-	g_ptr_array_add(success_hosts, s);
+	if (! fa->host_len) {
+		fa->host_len = name_width("");
+		for (int i=0; i<n_hosts(fa); i++) {
+			fa->host_len = MAX(fa->host_len,
+					   name_width(get_host(fa, i)));
+		}
+	}
+	return fa->host_len;
 }
 
 
 /**
- * Calculate the field width needed for host names. The width is the smallest
- * multiple of eight that is long enough for every host name.
+ * The smallest multiple of eight that is longer than a name.
  */
-int host_len(void)
+static int name_width(const char *name)
 {
-	static int len = 0;
-	if (! len) {
-		for (int i=0; i<n_hosts(); i++) {
-			GString *gs = get_host(i);
-			int tl = gs->len;
-			if (tl > len)
-				len = tl;
-		}
-		len += 8;
-		len -= (len % 8);
-	}
-	return len;
+	int len = strlen(name) + 8;
+
+	return len - (len % 8);
 }
 
 
@@ -610,4 +948,5 @@ void free_hostlistname(HostListName *hln)
 {
 	g_string_free(hln->pathname, TRUE);
 	g_string_free(hln->filename, TRUE);
+	free(hln);
 }
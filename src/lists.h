@@ -4,6 +4,8 @@
 
 #include <glib.h>
 
+#include "context.h"
+
 
 struct _hostListName {
 	GString *filename;
@@ -12,34 +14,52 @@ struct _hostListName {
 typedef struct _hostListName HostListName;
 
 
+/**
+ * A list file, parsed.  The daemon keeps these, so its workers don't read
+ * and parse the lists again for every job.
+ */
+struct _listFile {
+	GStringChunk *text;	/* Where the names are kept */
+	GPtrArray *hosts;	/* const char*, NULL where an include comes */
+	GPtrArray *includes;	/* const char*, the lists after each "+" */
+};
+typedef struct _listFile ListFile;
+
+
 // lists.c
-void init_lists(void);
+void init_lists(ForAll *fa);
 
 HostListName *new_hostlistname(GString *filename);
 void free_hostlistname(HostListName *hln);
 
-void add_host(GString *host);
-void add_not_host(GString *host);
-void add_list(GString *list);
-void add_not_list(GString *list);
-int host_len(void);
-int n_hosts(void);
-int n_not_hosts(void);
-int n_host_lists(void);
-int n_not_host_lists(void);
-void success(GString *s);
-void failure(GString *s);
-GString *get_success(int i);
-GString *get_failure(int i);
-int n_successes(void);
-int n_failures(void);
-GString *get_host(int i);
-GString *get_not_host(int i);
-HostListName *get_host_list(int i);
-HostListName *get_not_host_list(int i);
-void sort_hosts(void);
-void process_lists(void);
-int hosts_name_length(void);
+void add_host(ForAll *fa, const char *host);
+void add_not_host(ForAll *fa, const char *host);
+void add_list(ForAll *fa, GString *list);
+void add_not_list(ForAll *fa, GString *list);
+Bitset *read_list_set(ForAll *fa, const char *filename);
+void add_host_set(ForAll *fa, Bitset *set);
+void watch_not_lists(ForAll *fa);
+void check_not_lists(ForAll *fa);
+int host_len(ForAll *fa);
+int n_hosts(ForAll *fa);
+int n_not_hosts(ForAll *fa);
+int n_host_lists(ForAll *fa);
+int n_not_host_lists(ForAll *fa);
+const char *get_host(ForAll *fa, int i);
+HostId get_host_id(ForAll *fa, int i);
+const char *get_not_host(ForAll *fa, int i);
+HostListName *get_host_list(ForAll *fa, int i);
+HostListName *get_not_host_list(ForAll *fa, int i);
+void sort_hosts(ForAll *fa);
+void process_lists(ForAll *fa);
+void shard_hosts(ForAll *fa, int shard, int nshards);
+int add_host_line(ForAll *fa, char *line, int shard, int nshards);
+int is_host_name(ForAll *fa, const char *name, int len);
+int hosts_name_length(ForAll *fa);
+gchar **list_dirs(void);
+ListFile *read_list_file(ForAll *fa, const char *pathname);
+void free_list_file(ListFile *lf);
+gchar *list_cache_key(const char *pathname);
 
 
 #endif // lists_h_INCLUDED
@@ -0,0 +1,135 @@
+/*
+ * Write how a run went as a Prometheus text file, for node_exporter's
+ * textfile collector to pick up.  Everything comes from the status table,
+ * so it can be written at the end of any run.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "metrics.h"
+#include "results.h"
+
+
+/** Histogram buckets, in ms. */
+static const int buckets[] = {
+	50, 100, 250, 500, 1000, 2500, 5000, 10000, 30000, 60000, 120000,
+	300000,
+};
+#define N_BUCKETS (sizeof(buckets) / sizeof(buckets[0]))
+
+
+static void append_gauge(GString *gs, const char *name, const char *help,
+			 double value);
+static void append_histogram(ForAll *fa, GString *gs, const char *name,
+			     const char *help, int first_output);
+
+
+/**
+ * Write the metrics for the hosts that have finished.  The file is replaced
+ * in one go, so the collector never reads half of it.
+ *
+ * @return TRUE, or FALSE with error set
+ */
+int write_metrics(ForAll *fa, const char *filename, GError **error)
+{
+	GString *gs = g_string_new("");
+	int timed_out = 0;
+	int truncated = 0;
+	int ret;
+
+	for (int i=0; i<n_finished(fa); i++) {
+		HostStatus *st = get_status(fa, get_finished(fa, i));
+		if (RESULT_TIMEOUT == st->reason) {
+			timed_out ++;
+		}
+		if (st->flags & STATUS_TRUNCATED) {
+			truncated ++;
+		}
+	}
+	append_gauge(gs, "for_all_hosts_attempted",
+		     "Hosts the last run tried.", n_finished(fa));
+	append_gauge(gs, "for_all_hosts_succeeded",
+		     "Hosts that succeeded in the last run.", n_successes(fa));
+	append_gauge(gs, "for_all_hosts_failed",
+		     "Hosts that failed in the last run, including timeouts.",
+		     n_failures(fa));
+	append_gauge(gs, "for_all_hosts_timed_out",
+		     "Hosts that were killed after --timeout in the last run.",
+		     timed_out);
+	append_gauge(gs, "for_all_hosts_truncated",
+		     "Hosts that had output dropped by --max-output in the "
+		     "last run.", truncated);
+	append_gauge(gs, "for_all_hosts_skipped",
+		     "Hosts that -N lists excluded after the last run began.",
+		     n_skipped(fa));
+	append_gauge(gs, "for_all_run_seconds",
+		     "How long the last run took.",
+		     fa->started ? (g_get_monotonic_time() - fa->started) / 1e6
+		     : 0);
+	append_gauge(gs, "for_all_output_bytes",
+		     "Output read from the hosts in the last run.",
+		     fa->output_bytes);
+	append_gauge(gs, "for_all_peak_running",
+		     "Most hosts running at once in the last run.",
+		     fa->peak_running);
+	append_gauge(gs, "for_all_last_run_timestamp_seconds",
+		     "When the last run finished.", time(0));
+	append_histogram(fa, gs, "for_all_host_first_output_seconds",
+			 "Time from starting a host to its first output.",
+			 TRUE);
+	append_histogram(fa, gs, "for_all_host_duration_seconds",
+			 "Time from starting a host to it finishing, with "
+			 "retries.", FALSE);
+
+	ret = g_file_set_contents(filename, gs->str, gs->len, error);
+	g_string_free(gs, TRUE);
+	return ret;
+}
+
+
+static void append_gauge(GString *gs, const char *name, const char *help,
+			 double value)
+{
+	g_string_append_printf(gs, "# HELP %s %s\n# TYPE %s gauge\n%s %.17g\n",
+			       name, help, name, name, value);
+}
+
+
+/**
+ * @param first_output TRUE for the time to first output (of the hosts that
+ * had any), FALSE for the whole time
+ */
+static void append_histogram(ForAll *fa, GString *gs, const char *name,
+			     const char *help, int first_output)
+{
+	guint64 counts[N_BUCKETS] = { 0 };
+	guint64 count = 0;
+	gint64 sum = 0;
+
+	for (int i=0; i<n_finished(fa); i++) {
+		HostStatus *st = get_status(fa, get_finished(fa, i));
+		guint32 ms = first_output ? st->first_ms : st->ms;
+		if (first_output && ! ms) {
+			continue;
+		}
+		for (int b=0; b<N_BUCKETS; b++) {
+			if (ms <= buckets[b]) {
+				counts[b] ++;
+			}
+		}
+		count ++;
+		sum += ms;
+	}
+	g_string_append_printf(gs, "# HELP %s %s\n# TYPE %s histogram\n",
+			       name, help, name);
+	for (int b=0; b<N_BUCKETS; b++) {
+		g_string_append_printf(gs, "%s_bucket{le=\"%g\"} %"
+				       G_GUINT64_FORMAT "\n",
+				       name, buckets[b] / 1000.0, counts[b]);
+	}
+	g_string_append_printf(gs, "%s_bucket{le=\"+Inf\"} %" G_GUINT64_FORMAT
+			       "\n%s_sum %g\n%s_count %" G_GUINT64_FORMAT "\n",
+			       name, count, name, sum / 1000.0, name, count);
+}
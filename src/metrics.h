@@ -0,0 +1,13 @@
+#ifndef metrics_h_INCLUDED
+#define metrics_h_INCLUDED
+
+#include <glib.h>
+
+#include "context.h"
+
+
+// metrics.c
+int write_metrics(ForAll *fa, const char *filename, GError **error);
+
+
+#endif // metrics_h_INCLUDED
@@ -0,0 +1,213 @@
+/*
+ * Store each host name once, and refer to hosts by a 32 bit number.  With a
+ * hundred thousand hosts in the lists, a separate GString for every name,
+ * and another copy for each result, is most of our memory.  Here a name
+ * costs its characters, a pointer, its hash, and a little table space.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "names.h"
+
+
+/** How much name storage to allocate at once. */
+#define CHUNK_SIZE 65536
+/** The first size of the lookup table. */
+#define MIN_SLOTS 1024
+
+
+static void grow_slots(Names *n);
+static char *store_name(Names *n, const char *name, int len);
+
+
+Names *new_names(void)
+{
+	Names *n = g_new0(Names, 1);
+
+	n->chunks = g_ptr_array_new_with_free_func(g_free);
+	n->names = g_ptr_array_new();
+	n->hashes = g_array_new(FALSE, FALSE, sizeof(guint32));
+	n->flags = g_byte_array_new();
+	n->nslots = MIN_SLOTS;
+	n->slots = g_new0(guint32, n->nslots);
+	return n;
+}
+
+
+void free_names(Names *n)
+{
+	g_ptr_array_free(n->chunks, TRUE);
+	g_ptr_array_free(n->names, TRUE);
+	g_array_free(n->hashes, TRUE);
+	g_byte_array_free(n->flags, TRUE);
+	g_free(n->slots);
+	g_free(n);
+}
+
+
+/**
+ * Find a host name, adding it if we don't have it yet.
+ *
+ * @param name the name, which need not be NUL terminated
+ * @param len its length, or -1 if it is NUL terminated
+ * @return the name's id
+ */
+HostId intern_name(Names *n, const char *name, int len)
+{
+	HostId id;
+	guint32 hash, slot;
+	guint8 zero = 0;
+
+	if (len < 0) {
+		len = strlen(name);
+	}
+	id = find_name(n, name, len);
+	if (NO_HOST != id) {
+		return id;
+	}
+	// Keep the table at most half full.
+	if (2 * (n->names->len + 1) > n->nslots) {
+		grow_slots(n);
+	}
+	id = n->names->len;
+	hash = host_hash(name, len);
+	g_ptr_array_add(n->names, store_name(n, name, len));
+	g_array_append_val(n->hashes, hash);
+	g_byte_array_append(n->flags, &zero, 1);
+	for (slot = hash & (n->nslots - 1); n->slots[slot];
+	     slot = (slot + 1) & (n->nslots - 1)) {
+	}
+	n->slots[slot] = id + 1;
+	return id;
+}
+
+
+/**
+ * Find a host name.
+ *
+ * @return the name's id, or NO_HOST if we don't have it
+ */
+HostId find_name(Names *n, const char *name, int len)
+{
+	guint32 hash, slot;
+
+	if (len < 0) {
+		len = strlen(name);
+	}
+	hash = host_hash(name, len);
+	for (slot = hash & (n->nslots - 1); n->slots[slot];
+	     slot = (slot + 1) & (n->nslots - 1)) {
+		HostId id = n->slots[slot] - 1;
+		const char *s = g_ptr_array_index(n->names, id);
+		if (hash == g_array_index(n->hashes, guint32, id)
+		    && 0 == strncmp(s, name, len) && '\0' == s[len]) {
+			return id;
+		}
+	}
+	return NO_HOST;
+}
+
+
+/**
+ * @return the name, which lasts as long as the Names does
+ */
+const char *name_of(Names *n, HostId id)
+{
+	g_assert(id < n->names->len);
+	return g_ptr_array_index(n->names, id);
+}
+
+
+/**
+ * @return host_hash() of the name, which we already have
+ */
+guint32 name_hash(Names *n, HostId id)
+{
+	g_assert(id < n->hashes->len);
+	return g_array_index(n->hashes, guint32, id);
+}
+
+
+/**
+ * A byte for each name, which the lists use to know which names they have
+ * without searching.
+ */
+guint8 *name_flags(Names *n, HostId id)
+{
+	g_assert(id < n->flags->len);
+	return &n->flags->data[id];
+}
+
+
+/** How many names there are.  Ids go from 0 to one less than this. */
+guint32 n_names(Names *n)
+{
+	return n->names->len;
+}
+
+
+/**
+ * FNV-1a hash of a host name.  This must not change between versions, as
+ * it decides which shard a host is in.
+ */
+guint32 host_hash(const char *name, int len)
+{
+	guint32 h = 2166136261u;
+
+	for (int i=0; i<len; i++) {
+		h ^= (unsigned char) name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+/**
+ * Double the lookup table, and put every name back in.
+ */
+static void grow_slots(Names *n)
+{
+	guint32 nslots = n->nslots * 2;
+
+	g_free(n->slots);
+	n->slots = g_new0(guint32, nslots);
+	n->nslots = nslots;
+	for (HostId id=0; id<n->names->len; id++) {
+		guint32 slot = name_hash(n, id) & (nslots - 1);
+		while (n->slots[slot]) {
+			slot = (slot + 1) & (nslots - 1);
+		}
+		n->slots[slot] = id + 1;
+	}
+}
+
+
+/**
+ * Copy a name into the chunks, with a NUL after it.
+ */
+static char *store_name(Names *n, const char *name, int len)
+{
+	char *s;
+
+	if (len + 1 > n->left) {
+		if (len + 1 > CHUNK_SIZE / 4) {
+			// A silly long name gets a chunk of its own, so we
+			// don't waste the rest of the current one.
+			s = g_malloc(len + 1);
+			g_ptr_array_add(n->chunks, s);
+			memcpy(s, name, len);
+			s[len] = '\0';
+			return s;
+		}
+		n->free = g_malloc(CHUNK_SIZE);
+		n->left = CHUNK_SIZE;
+		g_ptr_array_add(n->chunks, n->free);
+	}
+	s = n->free;
+	memcpy(s, name, len);
+	s[len] = '\0';
+	n->free += len + 1;
+	n->left -= len + 1;
+	return s;
+}
@@ -0,0 +1,44 @@
+#ifndef names_h_INCLUDED
+#define names_h_INCLUDED
+
+#include <glib.h>
+
+
+/** A host name, as its index in a Names. */
+typedef guint32 HostId;
+
+/** Not a host. */
+#define NO_HOST G_MAXUINT32
+
+
+/**
+ * Every host name we know, each stored once.  The names are packed into large
+ * chunks that never move, so a name's pointer stays good as long as the
+ * Names does.
+ */
+struct _names {
+	GPtrArray *chunks;	/* char*, the storage */
+	char *free;		/* Next unused byte in the last chunk */
+	gsize left;		/* Unused bytes in the last chunk */
+	GPtrArray *names;	/* const char*, by HostId */
+	GArray *hashes;		/* guint32, host_hash() of each name */
+	GByteArray *flags;	/* For the lists to mark names with */
+	guint32 *slots;		/* Open addressed table, HostId+1 or 0 */
+	guint32 nslots;		/* A power of two */
+};
+typedef struct _names Names;
+
+
+// names.c
+Names *new_names(void);
+void free_names(Names *n);
+HostId intern_name(Names *n, const char *name, int len);
+HostId find_name(Names *n, const char *name, int len);
+const char *name_of(Names *n, HostId id);
+guint32 name_hash(Names *n, HostId id);
+guint8 *name_flags(Names *n, HostId id);
+guint32 n_names(Names *n);
+guint32 host_hash(const char *name, int len);
+
+
+#endif // names_h_INCLUDED
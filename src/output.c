@@ -0,0 +1,201 @@
+/*
+ * Writing hosts' output to stdout, either as it comes, held back per host, or
+ * a line at a time with the host name in front.
+ */
+
+#define _XOPEN_SOURCE 600
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "output.h"
+
+
+static void write_all(const char *buf, int len);
+static void write_lines(void);
+static void write_out(const char *buf, int len);
+static void line_out(HostRun *hr);
+
+
+/** Do we hold back each host's output until that host is done? */
+static int buffered = 0;
+
+/** Whole lines from all hosts, waiting to be written in one go. */
+static GString *lines = 0;
+/** Write the lines when there are this many bytes. */
+#define LINES_SIZE 65536
+
+/** For lines and stdout, which --threads workers share. */
+static GMutex lock;
+
+
+/**
+ * @param buffer TRUE to hold back each host's output until host_flush()
+ */
+void init_output(int buffer)
+{
+	buffered = buffer;
+	g_mutex_init(&lock);
+}
+
+
+/**
+ * Output for a host.  Straight to stdout if we're running one host at a
+ * time, otherwise held until host_flush().
+ */
+void host_write(HostRun *hr, const char *buf, int len)
+{
+	if (buffered) {
+		if (! hr->output) {
+			hr->output = g_string_new("");
+		}
+		g_string_append_len(hr->output, buf, len);
+	} else {
+		write_all(buf, len);
+	}
+}
+
+
+/**
+ * @see host_write()
+ */
+void host_printf(HostRun *hr, const char *fmt, ...)
+{
+	va_list ap;
+	GString *gs = g_string_new("");
+
+	va_start(ap, fmt);
+	g_string_vprintf(gs, fmt, ap);
+	va_end(ap);
+	host_write(hr, gs->str, gs->len);
+	g_string_free(gs, TRUE);
+}
+
+
+/**
+ * Write out a host's held back output.
+ */
+void host_flush(HostRun *hr)
+{
+	if (hr->output && hr->output->len) {
+		write_all(hr->output->str, hr->output->len);
+		g_string_truncate(hr->output, 0);
+	}
+}
+
+
+/**
+ * Output for a host, to be written a line at a time with the host name in
+ * front of each line.  The start of a line is kept until its newline comes,
+ * so lines from different hosts never mix.
+ */
+void host_lines(HostRun *hr, const char *buf, int len)
+{
+	const char *end = buf + len;
+
+	if (! hr->partial) {
+		hr->partial = g_string_new("");
+	}
+	while (buf < end) {
+		const char *nl = memchr(buf, '\n', end - buf);
+		if (! nl) {
+			g_string_append_len(hr->partial, buf, end - buf);
+			break;
+		}
+		g_string_append_len(hr->partial, buf, nl - buf);
+		line_out(hr);
+		buf = nl + 1;
+	}
+}
+
+
+/**
+ * Finish the line that host_lines() has for a host, if there is one.
+ */
+void host_lines_end(HostRun *hr)
+{
+	if (hr->partial && hr->partial->len) {
+		line_out(hr);
+	}
+}
+
+
+/**
+ * Queue up the host's line for writing.
+ */
+static void line_out(HostRun *hr)
+{
+	GString *p = hr->partial;
+
+	// The pty turns \n into \r\n.
+	if (p->len && '\r' == p->str[p->len-1]) {
+		g_string_truncate(p, p->len-1);
+	}
+	g_mutex_lock(&lock);
+	if (! lines) {
+		lines = g_string_sized_new(LINES_SIZE);
+	}
+	g_string_append(lines, hr->host);
+	g_string_append_len(lines, ": ", 2);
+	g_string_append_len(lines, p->str, p->len);
+	g_string_append_c(lines, '\n');
+	if (lines->len >= LINES_SIZE) {
+		write_lines();
+	}
+	g_mutex_unlock(&lock);
+	g_string_truncate(p, 0);
+}
+
+
+/**
+ * Write out the lines that host_lines() has queued up.
+ */
+void flush_lines(void)
+{
+	g_mutex_lock(&lock);
+	write_lines();
+	g_mutex_unlock(&lock);
+}
+
+
+static void write_lines(void)
+{
+	if (lines && lines->len) {
+		fflush(stdout);
+		write_out(lines->str, lines->len);
+		g_string_truncate(lines, 0);
+	}
+}
+
+
+static void write_all(const char *buf, int len)
+{
+	g_mutex_lock(&lock);
+	fflush(stdout);
+	write_lines();
+	write_out(buf, len);
+	g_mutex_unlock(&lock);
+}
+
+
+static void write_out(const char *buf, int len)
+{
+	int written = 0;
+	int writeval;
+
+	while (written < len) {
+		writeval = write(1, buf+written, len-written);
+		if (-1 == writeval) {
+			if (EINTR == errno) {
+				continue;
+			}
+			exit(5);
+		}
+		written += writeval;
+	}
+}
@@ -0,0 +1,17 @@
+#ifndef output_h_INCLUDED
+#define output_h_INCLUDED
+
+#include "run-command.h"
+
+
+// output.c
+void init_output(int buffer);
+void host_write(HostRun *hr, const char *buf, int len);
+void host_printf(HostRun *hr, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+void host_flush(HostRun *hr);
+void host_lines(HostRun *hr, const char *buf, int len);
+void host_lines_end(HostRun *hr);
+void flush_lines(void);
+
+
+#endif // output_h_INCLUDED
@@ -0,0 +1,314 @@
+/*
+ * Running hosts on more than one thread, for when one thread can't keep up
+ * with reading and handling the output of thousands of hosts.  Each worker
+ * thread has a Runner of its own, with its own children, descriptors and
+ * buffers, and takes the next host from the shared order whenever it has
+ * room for one.  So no host waits behind a busy worker while another is
+ * idle.
+ *
+ * A finished host goes back to the thread driving the pool, so done(), the
+ * results and the history are only touched by that thread, and each host's
+ * output still goes out in one piece, in the order the hosts finish.
+ */
+
+#include <glib.h>
+#include <assert.h>
+
+#include "pool.h"
+#include "run-command.h"
+
+
+static gpointer run_worker(gpointer data);
+static int worker_step(HostRun *hr, void *data);
+static void worker_output(HostRun *hr, const char *buf, int len, void *data);
+static void worker_done(HostRun *hr, void *data);
+static ForAll *worker_context(ForAll *fa, int i, int nworkers);
+static int share(int n, int i, int nworkers);
+static PoolWorker *find_worker(Pool *p, gpointer item);
+static void host_finished(Pool *p, HostRun *hr);
+static void add_worker_counts(Pool *p, PoolWorker *w);
+
+
+/** What the workers' Runners do, passing step() and output() on. */
+static RunOps worker_ops = {
+	worker_step,
+	worker_output,
+	worker_done,
+};
+
+
+/**
+ * Set up to run the hosts on nthreads threads, which start with the first
+ * pool_iterate().  The threads split parallel between them, so together they
+ * never run more than that.  Hosts waiting for room in their groups wait in
+ * one queue, for whichever thread has room first.  step() and output() are
+ * called on the worker threads, so they must only change the HostRun, and
+ * what is safe to share between threads.
+ *
+ * @param order indexes (int) into the hosts list, which the pool frees
+ * @see new_runner()
+ */
+Pool *new_pool(ForAll *fa, GArray *order, int parallel, int nthreads,
+	       RunOps *ops, void *data)
+{
+	Pool *p = g_new0(Pool, 1);
+
+	if (! fa->budget) {
+		fa->budget = new_budget(fa->no_pty, fa->debug);
+	}
+	// Each thread needs room for at least one host of its own.
+	parallel = MAX(parallel, 1);
+	nthreads = CLAMP(nthreads, 1, parallel);
+	nthreads = MIN(nthreads, MAX(1, fa->budget->limit));
+	if (fa->adaptive) {
+		nthreads = MIN(nthreads, fa->adaptive->max);
+	}
+	p->fa = fa;
+	p->order = order;
+	p->ops = ops;
+	p->data = data;
+	p->done = g_async_queue_new();
+	if (! fa->started) {
+		fa->started = g_get_monotonic_time();
+	}
+	p->blocked = g_queue_new();
+	g_mutex_init(&p->lock);
+	p->nworkers = nthreads;
+	p->workers = g_new0(PoolWorker, nthreads);
+	for (int i=0; i<nthreads; i++) {
+		PoolWorker *w = &p->workers[i];
+		w->pool = p;
+		w->fa = worker_context(fa, i, nthreads);
+		w->runner = new_runner(w->fa, order,
+				       share(parallel, i, nthreads),
+				       &worker_ops, w);
+		w->runner->claim = &p->next;
+		w->runner->all_running = &p->running;
+		g_queue_free(w->runner->blocked);
+		w->runner->blocked = p->blocked;
+		w->runner->lock = &p->lock;
+		w->runner->blocked_max = parallel;
+		w->runner->keep_hosts = TRUE;
+	}
+	return p;
+}
+
+
+/**
+ * Have each worker call round() each time round its loop, eg to write out
+ * output that it has queued up.
+ */
+void pool_rounds(Pool *p, void (*round)(void))
+{
+	p->round = round;
+}
+
+
+/**
+ * Wait up to timeout for hosts to finish, and call done() for each of them.
+ *
+ * @param timeout ms, or -1 to wait until a host finishes
+ * @return TRUE while there are hosts to run, FALSE when all are done
+ */
+int pool_iterate(Pool *p, int timeout)
+{
+	gpointer item;
+
+	if (! p->started) {
+		for (int i=0; i<p->nworkers; i++) {
+			p->workers[i].thread = g_thread_new("for-all",
+							    run_worker,
+							    &p->workers[i]);
+		}
+		p->working = p->nworkers;
+		p->started = TRUE;
+	}
+	if (! p->working) {
+		return FALSE;
+	}
+	if (-1 == timeout) {
+		item = g_async_queue_pop(p->done);
+	} else {
+		item = g_async_queue_timeout_pop(p->done,
+						 timeout * (guint64) 1000);
+	}
+	// Then whatever else is there, without waiting again.
+	while (item) {
+		PoolWorker *w = find_worker(p, item);
+		if (w) {
+			g_thread_join(w->thread);
+			w->thread = 0;
+			p->working --;
+		} else {
+			host_finished(p, item);
+		}
+		item = g_async_queue_try_pop(p->done);
+	}
+	return p->working > 0;
+}
+
+
+/**
+ * Free the pool once pool_iterate() has said it is done, adding up what the
+ * workers counted in the pool's context.
+ */
+void free_pool(Pool *p)
+{
+	Budget *b = p->fa->budget;
+	int limit = 0;
+
+	assert(0 == p->working);
+	for (int i=0; i<p->nworkers; i++) {
+		PoolWorker *w = &p->workers[i];
+		add_worker_counts(p, w);
+		limit += w->fa->budget->limit;
+		free_runner(w->runner);
+		g_free(w->fa->budget);
+		g_free(w->fa->adaptive);
+		g_free(w->fa);
+	}
+	if (limit < b->limit) {
+		b->limit = limit;
+	}
+	g_array_free(p->order, TRUE);
+	g_queue_free(p->blocked);
+	g_mutex_clear(&p->lock);
+	g_async_queue_unref(p->done);
+	g_free(p->workers);
+	g_free(p);
+}
+
+
+static gpointer run_worker(gpointer data)
+{
+	PoolWorker *w = data;
+	Pool *p = w->pool;
+
+	while (runner_iterate(w->runner, -1)) {
+		if (p->round) {
+			p->round();
+		}
+	}
+	if (p->round) {
+		p->round();
+	}
+	// Everything this worker finished is ahead of this in the queue.
+	g_async_queue_push(p->done, w);
+	return 0;
+}
+
+
+static int worker_step(HostRun *hr, void *data)
+{
+	Pool *p = ((PoolWorker *) data)->pool;
+
+	return p->ops->step(hr, p->data);
+}
+
+
+static void worker_output(HostRun *hr, const char *buf, int len, void *data)
+{
+	Pool *p = ((PoolWorker *) data)->pool;
+
+	p->ops->output(hr, buf, len, p->data);
+}
+
+
+/**
+ * Hand a finished or skipped host to the pool's thread.  It is freed there.
+ */
+static void worker_done(HostRun *hr, void *data)
+{
+	Pool *p = ((PoolWorker *) data)->pool;
+
+	g_async_queue_push(p->done, hr);
+}
+
+
+/**
+ * A worker's copy of the context.  The hosts, names and options are shared,
+ * and only read while the pool runs.  The worker has its own share of the
+ * budget and the adaptive window, and its own counts, as its Runner changes
+ * those as it goes.  The history is left to the pool's thread.
+ *
+ * @param i which of the nworkers this is
+ */
+static ForAll *worker_context(ForAll *fa, int i, int nworkers)
+{
+	ForAll *copy = g_new(ForAll, 1);
+
+	*copy = *fa;
+	copy->budget = g_new(Budget, 1);
+	*copy->budget = *fa->budget;
+	copy->budget->limit = MAX(1, share(fa->budget->limit, i, nworkers));
+	copy->budget->throttled = 0;
+	copy->budget->exhausted = 0;
+	if (fa->adaptive) {
+		copy->adaptive = new_adaptive(
+			MAX(1, share(adaptive_limit(fa->adaptive), i,
+				     nworkers)),
+			share(fa->adaptive->max, i, nworkers), fa->debug);
+	}
+	copy->history = 0;
+	copy->output_bytes = 0;
+	copy->peak_running = 0;
+	return copy;
+}
+
+
+/**
+ * Split n between nworkers, so the shares add up to n, with the first
+ * workers getting one more when it doesn't split evenly.
+ *
+ * @return worker i's share
+ */
+static int share(int n, int i, int nworkers)
+{
+	return n / nworkers + (i < n % nworkers);
+}
+
+
+/**
+ * @return the worker, if that's what item is, or NULL for a HostRun
+ */
+static PoolWorker *find_worker(Pool *p, gpointer item)
+{
+	for (int i=0; i<p->nworkers; i++) {
+		if (item == &p->workers[i]) {
+			return &p->workers[i];
+		}
+	}
+	return 0;
+}
+
+
+static void host_finished(Pool *p, HostRun *hr)
+{
+	if (hr->skipped) {
+		record_skipped(p->fa, hr->id);
+		free_host_run(hr);
+		return;
+	}
+	record_history(p->fa, hr);
+	p->ops->done(hr, p->data);
+	free_host_run(hr);
+}
+
+
+/**
+ * Each worker's peak is of the hosts running in all the workers, so the
+ * pool's is the highest of them.
+ */
+static void add_worker_counts(Pool *p, PoolWorker *w)
+{
+	Budget *b = p->fa->budget;
+	Budget *wb = w->fa->budget;
+
+	p->fa->output_bytes += w->fa->output_bytes;
+	p->fa->peak_running = MAX(p->fa->peak_running, w->fa->peak_running);
+	b->throttled += wb->throttled;
+	b->exhausted += wb->exhausted;
+	if (wb->exhausted) {
+		b->why = wb->why;
+	}
+}
@@ -0,0 +1,58 @@
+#ifndef pool_h_INCLUDED
+#define pool_h_INCLUDED
+
+#include <glib.h>
+
+#include "context.h"
+#include "run-command.h"
+
+
+typedef struct _pool Pool;
+
+/**
+ * One worker thread, with its own Runner and its own copy of the context.
+ */
+struct _poolWorker {
+	Pool *pool;
+	ForAll *fa;		/* Copy of the pool's context, see new_pool() */
+	Runner *runner;
+	GThread *thread;
+};
+typedef struct _poolWorker PoolWorker;
+
+
+/**
+ * Hosts run by several threads, each with its own Runner, children and
+ * descriptors.  The threads take hosts from one order as they have room,
+ * and hand each finished host back to the thread that calls pool_iterate(),
+ * which is the only one that calls done() or touches the results.
+ */
+struct _pool {
+	ForAll *fa;
+	GArray *order;		/* Indexes (int) into the hosts list */
+	gint next;		/* Next host in order, for any worker to take */
+	gint running;		/* Hosts running in all the workers */
+	GQueue *blocked;	/* HostRun*, waiting for room in their groups,
+				   for any worker to start */
+	GMutex lock;		/* For blocked */
+	int nworkers;
+	PoolWorker *workers;
+	int started;		/* The threads are running */
+	int working;		/* Threads that have not finished */
+	GAsyncQueue *done;	/* HostRun* that are finished, or a PoolWorker*
+				   when that thread has no more to do */
+	void (*round)(void);	/* Called by each worker each time round */
+	RunOps *ops;
+	void *data;		/* For the RunOps */
+};
+
+
+// pool.c
+Pool *new_pool(ForAll *fa, GArray *order, int parallel, int nthreads,
+	       RunOps *ops, void *data);
+void pool_rounds(Pool *p, void (*round)(void));
+int pool_iterate(Pool *p, int timeout);
+void free_pool(Pool *p);
+
+
+#endif // pool_h_INCLUDED
@@ -0,0 +1,177 @@
+/*
+ * How each host went.  There is one HostStatus for each host name, found by
+ * its id, with bit sets of the hosts that succeeded and failed.  Nothing is
+ * turned into text until something asks for a report.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "results.h"
+
+
+void init_results(ForAll *fa)
+{
+	fa->status = g_array_new(FALSE, TRUE, sizeof(HostStatus));
+	fa->finished = g_array_new(FALSE, FALSE, sizeof(HostId));
+	fa->succeeded = new_bitset();
+	fa->failed = new_bitset();
+	fa->skipped = new_bitset();
+}
+
+
+void free_results(ForAll *fa)
+{
+	g_array_free(fa->status, TRUE);
+	g_array_free(fa->finished, TRUE);
+	free_bitset(fa->succeeded);
+	free_bitset(fa->failed);
+	free_bitset(fa->skipped);
+}
+
+
+/**
+ * A host has finished.  If it finished before (eg in an earlier run in the
+ * same context), this replaces that.
+ */
+void set_status(ForAll *fa, HostId id, const HostStatus *st)
+{
+	HostStatus *old;
+
+	if (id >= fa->status->len) {
+		g_array_set_size(fa->status, n_names(fa->names));
+	}
+	old = &g_array_index(fa->status, HostStatus, id);
+	if (RESULT_NONE == old->reason) {
+		g_array_append_val(fa->finished, id);
+	}
+	*old = *st;
+	if (status_ok(st)) {
+		bitset_add(fa->succeeded, id);
+		bitset_remove(fa->failed, id);
+	} else {
+		bitset_add(fa->failed, id);
+		bitset_remove(fa->succeeded, id);
+	}
+}
+
+
+/**
+ * @return how the host went, or NULL if it hasn't finished
+ */
+HostStatus *get_status(ForAll *fa, HostId id)
+{
+	HostStatus *st;
+
+	if (id >= fa->status->len) {
+		return NULL;
+	}
+	st = &g_array_index(fa->status, HostStatus, id);
+	return RESULT_NONE == st->reason ? NULL : st;
+}
+
+
+int status_ok(const HostStatus *st)
+{
+	return RESULT_OK == st->reason || RESULT_UNCHANGED == st->reason;
+}
+
+
+/**
+ * Describe how a host went, for the end of its line in the success or
+ * failure list.  Nothing is added for a plain success.
+ */
+void append_status(ForAll *fa, GString *gs, const HostStatus *st)
+{
+	if (st->step) {
+		g_string_append_printf(gs, "step %d: ", st->step);
+	}
+	switch (st->reason) {
+	case RESULT_UNCHANGED:
+		g_string_append(gs, "unchanged");
+		break;
+	case RESULT_EXIT:
+		g_string_append_printf(gs, "(%d)", st->code);
+		break;
+	case RESULT_SIGNAL:
+		g_string_append_printf(gs, "(signal %d)", st->code);
+		break;
+	case RESULT_NO_START:
+		g_string_append_printf(gs, "Cannot start: %s",
+				       strerror(st->error));
+		break;
+	case RESULT_NO_EXEC:
+		g_string_append_printf(gs, "Cannot exec %s", fa->ssh->str);
+		break;
+	case RESULT_TIMEOUT:
+		g_string_append(gs, "timed out");
+		break;
+	}
+	if (st->flags & STATUS_TRUNCATED) {
+		g_string_append(gs, gs->len ? ", output truncated"
+				: "output truncated");
+	}
+}
+
+
+/**
+ * Write the finished hosts in a set to a file as a host list, one name per
+ * line, that -H can read.  The file is replaced in one go (with a temporary
+ * file and rename()), so a run reading it never sees half of it.
+ *
+ * @param which fa->succeeded or fa->failed
+ * @return TRUE, or FALSE with error set
+ */
+int write_hosts(ForAll *fa, Bitset *which, const char *filename,
+		GError **error)
+{
+	GString *gs = g_string_new("");
+	int ret;
+
+	for (int i=0; i<n_finished(fa); i++) {
+		HostId id = get_finished(fa, i);
+		if (bitset_has(which, id)) {
+			g_string_append(gs, name_of(fa->names, id));
+			g_string_append_c(gs, '\n');
+		}
+	}
+	ret = g_file_set_contents(filename, gs->str, gs->len, error);
+	g_string_free(gs, TRUE);
+	return ret;
+}
+
+
+/**
+ * A host was not started, because a -N list excluded it after the run began.
+ */
+void record_skipped(ForAll *fa, HostId id)
+{
+	bitset_add(fa->skipped, id);
+}
+
+
+/** How many hosts succeeded? */
+int n_successes(ForAll *fa) { return bitset_count(fa->succeeded); }
+
+/** How many hosts failed? */
+int n_failures(ForAll *fa) { return bitset_count(fa->failed); }
+
+/** How many hosts were skipped? */
+int n_skipped(ForAll *fa) { return bitset_count(fa->skipped); }
+
+/** How many hosts have finished? */
+int n_finished(ForAll *fa) { return fa->finished->len; }
+
+
+/**
+ * Get one finished host, in the order they finished.
+ *
+ * @see n_finished()
+ */
+HostId get_finished(ForAll *fa, int i)
+{
+	assert(i >= 0);
+	assert(i < fa->finished->len);
+	return g_array_index(fa->finished, HostId, i);
+}
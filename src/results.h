@@ -0,0 +1,62 @@
+#ifndef results_h_INCLUDED
+#define results_h_INCLUDED
+
+#include <glib.h>
+
+#include "context.h"
+
+
+/**
+ * How a host finished.
+ */
+enum _hostReason {
+	RESULT_NONE = 0,	/* Not finished */
+	RESULT_OK,		/* Exit 0 */
+	RESULT_UNCHANGED,	/* Exit 0, with nothing to copy */
+	RESULT_EXIT,		/* Exit code, not 0 */
+	RESULT_SIGNAL,		/* Killed by a signal */
+	RESULT_NO_START,	/* Could not start ssh, see error */
+	RESULT_NO_EXEC,		/* Could not exec ssh */
+	RESULT_TIMEOUT,		/* Killed after --timeout */
+};
+typedef enum _hostReason HostReason;
+
+
+/**
+ * What happened to one host.  Times are ms, and a time of 0 means it didn't
+ * happen.
+ */
+struct _hostStatus {
+	guint8 reason;		/* HostReason */
+	guint8 code;		/* Exit code or signal number */
+	guint8 flags;		/* STATUS_TRUNCATED */
+	guint8 step;		/* The --script step that failed, from 1 */
+	guint16 error;		/* errno, for RESULT_NO_START */
+	guint32 start_ms;	/* When it started, since the run started */
+	guint32 first_ms;	/* Its first output, since it started */
+	guint32 ms;		/* How long it took, with any retries */
+};
+typedef struct _hostStatus HostStatus;
+
+/* HostStatus flags. */
+#define STATUS_TRUNCATED 0x01	/* Some output was dropped */
+
+
+// results.c
+void init_results(ForAll *fa);
+void free_results(ForAll *fa);
+void set_status(ForAll *fa, HostId id, const HostStatus *st);
+HostStatus *get_status(ForAll *fa, HostId id);
+int status_ok(const HostStatus *st);
+void append_status(ForAll *fa, GString *gs, const HostStatus *st);
+void record_skipped(ForAll *fa, HostId id);
+int n_successes(ForAll *fa);
+int n_failures(ForAll *fa);
+int n_skipped(ForAll *fa);
+int n_finished(ForAll *fa);
+HostId get_finished(ForAll *fa, int i);
+int write_hosts(ForAll *fa, Bitset *which, const char *filename,
+		GError **error);
+
+
+#endif // results_h_INCLUDED
@@ -1,4 +1,4 @@
-#define _XOPEN_SOURCE 600	/* For posix_openpt(), grantpt() etc */
+#define _GNU_SOURCE	/* For posix_openpt(), grantpt(), POSIX_SPAWN_SETSID */
 
 #include <glib.h>
 #include <stdio.h>
@@ -14,202 +14,1393 @@
 #include <stdlib.h>		/* posix_openpt() */
 #include <fcntl.h>
 #include <errno.h>
-#include <sys/select.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
 
-#include "options.h"
+#include "adaptive.h"
+#include "budget.h"
 #include "run-command.h"
 #include "lists.h"
 #include "utils.h"
 
 
-static void run_child(char *slavename, char *prog, char **argp);
-static void run_parent(int fd, GString *prog, GString *host, pid_t pid);
+static int run_command(ForAll *fa, HostRun *hr, int can_wait);
+static int run_pipe(ForAll *fa, HostRun *hr, int can_wait);
+static void step_started(HostRun *hr, int fd);
+static void run_child(int slave, char *prog, char **argp,
+		      int in_fd, int out_fd);
+static int read_host(Runner *r, HostRun *hr);
+static int start_step(Runner *r, HostRun *hr);
+static int end_step(Runner *r, HostRun *hr);
+static int retry_host(Runner *r, HostRun *hr);
+static int others_running(Runner *r, HostRun *hr);
+static gint compare_due(gconstpointer a, gconstpointer b, gpointer data);
+static void connect_options(ForAll *fa, Template *t);
+static void trace_running(Runner *r, int allowed);
+static int retry_wait(Runner *r);
+static void kill_late(Runner *r);
+static void capped_output(Runner *r, HostRun *hr, const char *buf, int len);
+static void end_output(Runner *r, HostRun *hr);
+static void watch_host(Runner *r, HostRun *hr, int op);
+static void host_ready(Runner *r, HostRun *hr);
+static int next_index(Runner *r);
+static int hosts_left(Runner *r);
+static HostRun *unblocked_host(Runner *r);
+static void block_host(Runner *r, HostRun *hr);
+static int blocked_hosts(Runner *r);
+static void skip_host(Runner *r, HostRun *hr);
+
+
+/** The longest we wait before a retry, in ms. */
+#define RETRY_BACKOFF_MAX 60000
+/** How long a step has to go after SIGTERM, before SIGKILL (ms). */
+#define KILL_GRACE 5000
+/* For watch_host(). */
+#define WATCH_ADD	1
+#define WATCH_DEL	2
+/** How often hosts waiting for a group look again, when another Runner may
+ * have made room (ms). */
+#define GROUP_RECHECK 100
+
+/** How much we read at once from a host. */
+#define READ_SIZE 16384
+/** How much we read at once from a host whose output we are dropping. */
+#define DRAIN_SIZE 65536
+
+/* posix_openpt() can only be asked for close on exec on some systems. */
+#ifdef __linux__
+#define PTY_CLOEXEC O_CLOEXEC
+#else
+#define PTY_CLOEXEC 0
+#endif
+
+
+/**
+ * Make a template with the ssh program, its options, and the host name.  The
+ * caller adds the remote command, and fills it in for each host with
+ * host_args().
+ *
+ * @param fa has the ssh program, the user and the "-o" options
+ * @param flags SSH_NO_STDIN, SSH_TTY, SSH_MUX
+ */
+Template *ssh_template(ForAll *fa, int flags)
+{
+	static GString *control_path = 0;
+	Template *t = new_template();
+
+	if (fa->mux_all) {
+		flags |= SSH_MUX;
+	}
+	// A remote tty is no use without a local one.
+	if (fa->no_pty) {
+		flags &= ~SSH_TTY;
+	}
+	template_add_literal(t, g2c(fa->ssh));
+	if (flags & SSH_NO_STDIN) {
+		template_add_literal(t, "-n");
+	}
+	template_add_literal(t, "-q");
+	template_add_literal(t, (flags & SSH_TTY) ? "-t" : "-T");
+	if (fa->user) {
+		template_add_literal(t, "-l");
+		template_add_literal(t, g2c(fa->user));
+	}
+	if (flags & SSH_MUX) {
+		// The first step to each host becomes the master, and later
+		// steps to that host reuse its connection.
+		if (! control_path) {
+			control_path = g_string_new("");
+			g_string_printf(control_path,
+					"ControlPath=%s/for-all-%%C",
+					g_get_user_runtime_dir());
+		}
+		template_add_literal(t, "-o");
+		template_add_literal(t, "ControlMaster=auto");
+		template_add_literal(t, "-o");
+		template_add_literal(t, g2c(control_path));
+		template_add_literal(t, "-o");
+		template_add_literal(t, g2c(fa->mux_persist));
+	}
+	// ssh has its own % tokens in options, such as %h and %i.
+	for (int i=0; i<fa->ssh_options->len; i++) {
+		template_add_literal(t, "-o");
+		template_add_literal(t, a2g2c(fa->ssh_options, i));
+	}
+	if (fa->trace && fa->trace->connect_fifo) {
+		connect_options(fa, t);
+	}
+	template_add(t, "%h");
+	template_add_literal(t, "--");
+	return t;
+}
+
+
+/**
+ * Have ssh tell --trace when it has connected, by writing the host's index to
+ * the trace's fifo from its LocalCommand.  A LocalCommand given with -o wins,
+ * and then there are no connect events.
+ */
+static void connect_options(ForAll *fa, Template *t)
+{
+	GString *gs;
+	gchar *quoted;
+
+	for (int i=0; i<fa->ssh_options->len; i++) {
+		const char *opt = a2g2c(fa->ssh_options, i);
+		if (0 == g_ascii_strncasecmp(opt, "LocalCommand", 12)
+		    && strchr("= \t", opt[12])) {
+			return;
+		}
+	}
+	gs = g_string_new("LocalCommand=echo %i >");
+	quoted = g_shell_quote(fa->trace->connect_fifo);
+	// Both we and ssh take % as the start of a token.
+	for (char *p = quoted; *p; p++) {
+		if ('%' == *p) {
+			g_string_append(gs, "%%%");
+		}
+		g_string_append_c(gs, *p);
+	}
+	g_free(quoted);
+	template_add_literal(t, "-o");
+	template_add_literal(t, "PermitLocalCommand=yes");
+	template_add_literal(t, "-o");
+	template_add(t, gs->str);
+	g_string_free(gs, TRUE);
+}
+
+
+/**
+ * Fill in a template for a host, adding the words to hr->args.  The filled
+ * in words are kept with the host until its next step.
+ */
+void host_args(ForAll *fa, HostRun *hr, Template *t)
+{
+	TemplateVars v;
+
+	v.host = hr->host;
+	v.index = hr->index;
+	v.user = fa->user ? g2c(fa->user) : g_get_user_name();
+	if (! hr->argbuf) {
+		hr->argbuf = g_string_new("");
+	}
+	template_fill(t, &v, hr->args, hr->argbuf);
+}
+
+
+/**
+ * Set up to run each of the hosts in order, with up to parallel of them going
+ * at once.  Nothing starts until runner_iterate().
+ *
+ * @param fa the hosts
+ * @param order indexes (int) into the hosts list, in the order to start them
+ * @param parallel how many hosts to run at once, or with an adaptive window
+ * the most hosts to run at once
+ * @param ops what to run on each host, and what to do with the results
+ * @param data passed to each of the ops
+ */
+Runner *new_runner(ForAll *fa, GArray *order, int parallel,
+		   RunOps *ops, void *data)
+{
+	Runner *r = g_new0(Runner, 1);
+
+	if (parallel < 1) {
+		parallel = 1;
+	}
+	r->fa = fa;
+	r->order = order;
+	if (! fa->started) {
+		fa->started = g_get_monotonic_time();
+	}
+	r->parallel = parallel;
+	r->blocked_max = parallel;
+	r->running = g_ptr_array_new();
+	r->retry = g_queue_new();
+	r->waiting = g_queue_new();
+	r->blocked = g_queue_new();
+	if (! fa->budget) {
+		fa->budget = new_budget(fa->no_pty, fa->debug);
+	}
+	// And one for the input, and one for --trace to hear of connections.
+	r->fds = g_new(struct pollfd, parallel + 2);
+	r->buf = g_malloc(DRAIN_SIZE);
+	r->input_fd = -1;
+	r->epfd = -1;
+#ifdef __linux__
+	// If there's no epoll, poll() does the same job more slowly.
+	if (! fa->use_poll) {
+		r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	}
+	if (-1 != r->epfd) {
+		r->events = g_new(struct epoll_event, parallel);
+	}
+#endif
+	r->ops = ops;
+	r->data = data;
+	return r;
+}
+
+
+void free_runner(Runner *r)
+{
+	assert(0 == r->running->len);
+	assert(g_queue_is_empty(r->retry));
+	assert(g_queue_is_empty(r->waiting));
+	if (r->free_data) {
+		r->free_data(r->data);
+	}
+	// A shared order belongs to whoever shared it.
+	if (! r->claim) {
+		g_array_free(r->order, TRUE);
+	}
+	g_ptr_array_free(r->running, TRUE);
+	g_queue_free(r->retry);
+	g_queue_free(r->waiting);
+	// So does a shared blocked queue.
+	if (! r->lock) {
+		assert(g_queue_is_empty(r->blocked));
+		g_queue_free(r->blocked);
+	}
+	g_free(r->fds);
+	g_free(r->buf);
+	if (-1 != r->epfd) {
+		close(r->epfd);
+		g_free(r->events);
+	}
+	g_free(r);
+}
+
+
+/**
+ * Start as many hosts as we can, then wait up to timeout for output and deal
+ * with it.
+ *
+ * @param timeout for poll(), in ms, or -1 to wait until something happens
+ * @return TRUE while there are hosts to run, FALSE when all are done
+ */
+int runner_iterate(Runner *r, int timeout)
+{
+	int limit = r->parallel;
+	struct pollfd *fds = r->fds;
+	int budget;
+	int held;
+	int wait;
+	int nfds;
+	int next;
+
+	if (r->fa->adaptive) {
+		limit = MIN(adaptive_limit(r->fa->adaptive), r->parallel);
+	}
+	budget = budget_limit(r->fa->budget);
+	while (r->running->len < MIN(limit, budget)) {
+		HostRun *hr;
+		if (! g_queue_is_empty(r->waiting)) {
+			// These are part way through starting.
+			hr = g_queue_pop_head(r->waiting);
+		} else if ((hr = unblocked_host(r))) {
+			// Its groups have room for it now.
+		} else if (hosts_left(r)
+			   && blocked_hosts(r) >= r->blocked_max) {
+			// Each wake looks at every blocked host, so leave the
+			// rest of the order until some of them have gone.
+			break;
+		} else if (-1 != (next = next_index(r))) {
+			hr = g_new0(HostRun, 1);
+			hr->index = g_array_index(r->order, int, next);
+			hr->id = get_host_id(r->fa, hr->index);
+			hr->host = name_of(r->fa->names, hr->id);
+			hr->status = -1;
+			hr->fd = -1;
+			hr->begun = g_get_monotonic_time();
+			TRACE(r->fa, TRACE_HOST, hr->id, 0, 0);
+		} else if (0 == retry_wait(r)) {
+			// Retries go after all the hosts that haven't had a go.
+			hr = g_queue_pop_head(r->retry);
+			hr->begun = g_get_monotonic_time();
+		} else {
+			break;
+		}
+		// Hosts part way through starting, or retrying, have begun.
+		if (r->fa->watch && ! hr->args && 0 == hr->attempt
+		    && watch_excluded(r->fa->watch, hr->id)) {
+			skip_host(r, hr);
+			continue;
+		}
+		if (r->fa->groups->limited && ! hr->groups
+		    && ! (hr->groups = groups_take(r->fa->groups, hr->id))) {
+			// One of its lists has as many running as it can.
+			block_host(r, hr);
+			continue;
+		}
+		if (r->held) {
+			r->fa->budget->throttled ++;
+		}
+		if (start_step(r, hr)) {
+			int running;
+			hr->slot = r->running->len;
+			g_ptr_array_add(r->running, hr);
+			running = r->running->len;
+			if (r->all_running) {
+				running = g_atomic_int_add(r->all_running, 1)
+					+ 1;
+			}
+			if (running > r->fa->peak_running) {
+				r->fa->peak_running = running;
+			}
+		} else if (! g_queue_is_empty(r->waiting)) {
+			// Out of something, so wait for a host to finish.
+			break;
+		}
+		budget = budget_limit(r->fa->budget);
+	}
+	// Are hosts waiting only because of the budget?
+	held = r->running->len >= budget && r->running->len < limit
+		&& hosts_left(r);
+	if (held && ! r->held) {
+		TRACE(r->fa, TRACE_HELD, NO_HOST, 0, 0);
+	}
+	r->held = held;
+	trace_running(r, MIN(limit, budget));
+	if (0 == r->running->len && g_queue_is_empty(r->retry)
+	    && g_queue_is_empty(r->waiting) && 0 == blocked_hosts(r)
+	    && -1 == r->input_fd) {
+		return hosts_left(r);
+	}
+
+	// Wake up in time for the next retry.
+	wait = runner_timeout(r);
+	if (-1 == wait || (-1 != timeout && timeout < wait)) {
+		wait = timeout;
+	}
+	nfds = runner_pollfds(r, &fds);
+	if (-1 == poll(fds, nfds, wait)) {
+		if (EINTR == errno) {
+			return TRUE;
+		}
+		fprintf(stderr, "poll: %s\n", strerror(errno));
+		exit(5);
+	}
+	if (-1 != r->input_fd && fds[nfds-1].revents) {
+		r->input(r, r->input_data);
+	}
+	if (r->fa->trace && -1 != r->fa->trace->connect_fd
+	    && fds[nfds - 1 - (-1 != r->input_fd)].revents) {
+		trace_connects(r->fa->trace, r->fa->hosts);
+	}
+#ifdef __linux__
+	if (-1 != r->epfd) {
+		int n = 0;
+		// Only the hosts that are ready, whatever the number running.
+		if (fds[0].revents) {
+			n = epoll_wait(r->epfd, r->events, r->parallel, 0);
+		}
+		for (int i=0; i<n; i++) {
+			host_ready(r, r->events[i].data.ptr);
+		}
+	} else
+#endif
+	// Backwards, so removing a host only moves one we have looked at.
+	for (int i=r->running->len-1; i>=0; i--) {
+		if (fds[i].revents) {
+			host_ready(r, g_ptr_array_index(r->running, i));
+		}
+	}
+	if (r->fa->timeout) {
+		kill_late(r);
+	}
+	trace_running(r, r->traced_allowed);
+	return hosts_left(r) || r->running->len
+		|| ! g_queue_is_empty(r->retry)
+		|| ! g_queue_is_empty(r->waiting)
+		|| blocked_hosts(r) || -1 != r->input_fd;
+}
+
+
+/**
+ * Read from a host that poll() or epoll says is ready, and if its step has
+ * ended, go on to the next one.  A host that is done leaves the running list,
+ * with the last host taking its slot.
+ */
+static void host_ready(Runner *r, HostRun *hr)
+{
+	// A host that is done has been freed by the time end_step() returns.
+	int slot = hr->slot;
+	int last = r->running->len - 1;
+
+	if (read_host(r, hr) || end_step(r, hr)) {
+		return;
+	}
+	if (slot != last) {
+		((HostRun *) g_ptr_array_index(r->running, last))->slot = slot;
+	}
+	g_ptr_array_remove_index_fast(r->running, slot);
+	if (r->all_running) {
+		g_atomic_int_add(r->all_running, -1);
+	}
+}
+
+
+/**
+ * Add a host to the end of the order, eg one that has just arrived on the
+ * input.
+ *
+ * @param index of the host in the hosts list
+ */
+void runner_add(Runner *r, int index)
+{
+	assert(! r->claim);
+	g_array_append_val(r->order, index);
+}
+
+
+/**
+ * Take the next host from the order, which other Runners may be taking from
+ * too.
+ *
+ * @return where the host is in the order, or -1 if there are none left
+ */
+static int next_index(Runner *r)
+{
+	int next;
+
+	if (! r->claim) {
+		return r->next < r->order->len ? r->next ++ : -1;
+	}
+	// Look first, so that the count only goes past the end once for
+	// each Runner that finds it there.
+	if (g_atomic_int_get(r->claim) >= r->order->len) {
+		return -1;
+	}
+	next = g_atomic_int_add(r->claim, 1);
+	return next < r->order->len ? next : -1;
+}
+
+
+/**
+ * Are there hosts in the order that no Runner has taken yet?
+ */
+static int hosts_left(Runner *r)
+{
+	if (r->claim) {
+		return g_atomic_int_get(r->claim) < r->order->len;
+	}
+	return r->next < r->order->len;
+}
+
+
+/**
+ * Take a host that was waiting for room in its groups, if a host has left one
+ * of the groups since we last looked and there is room now.
+ */
+static HostRun *unblocked_host(Runner *r)
+{
+	gint freed = g_atomic_int_get(&r->fa->groups->freed);
+
+	HostRun *found = 0;
+
+	if (freed == r->freed_seen) {
+		return 0;
+	}
+	if (r->lock) {
+		g_mutex_lock(r->lock);
+	}
+	for (GList *l=r->blocked->head; l; l=l->next) {
+		HostRun *hr = l->data;
+		hr->groups = groups_take(r->fa->groups, hr->id);
+		if (hr->groups) {
+			g_queue_delete_link(r->blocked, l);
+			hr->begun = g_get_monotonic_time();
+			found = hr;
+			break;
+		}
+	}
+	if (r->lock) {
+		g_mutex_unlock(r->lock);
+	}
+	if (! found) {
+		r->freed_seen = freed;
+	}
+	return found;
+}
+
+
+/**
+ * Put a host aside until there is room in its groups.  Runners that share
+ * the queue take from it as they have room.
+ */
+static void block_host(Runner *r, HostRun *hr)
+{
+	if (r->lock) {
+		g_mutex_lock(r->lock);
+	}
+	g_queue_push_tail(r->blocked, hr);
+	if (r->lock) {
+		g_mutex_unlock(r->lock);
+	}
+}
+
+
+/**
+ * How many hosts are waiting for room in their groups, for us or for the
+ * other Runners sharing the queue?
+ */
+static int blocked_hosts(Runner *r)
+{
+	int n;
+
+	if (r->lock) {
+		g_mutex_lock(r->lock);
+	}
+	n = r->blocked->length;
+	if (r->lock) {
+		g_mutex_unlock(r->lock);
+	}
+	return n;
+}
+
+
+/**
+ * Drop a host that a -N list has excluded since it was put in the order.  It
+ * is recorded as skipped, not finished.
+ */
+static void skip_host(Runner *r, HostRun *hr)
+{
+	if (hr->groups) {
+		groups_give(r->fa->groups, hr->groups);
+		hr->groups = 0;
+	}
+	TRACE(r->fa, TRACE_SKIP, hr->id, 0, 0);
+	TRACE(r->fa, TRACE_DONE, hr->id, 0, 0);
+	hr->skipped = TRUE;
+	if (r->keep_hosts) {
+		r->ops->done(hr, r->data);
+	} else {
+		record_skipped(r->fa, hr->id);
+		free_host_run(hr);
+	}
+}
+
+
+/**
+ * Have the runner wait for a file descriptor along with the hosts, and call
+ * input() when it is readable.  input() would read some more hosts and
+ * runner_add() them.  The runner keeps going until input() stops it with
+ * runner_input(r, -1, 0, 0), at the end of the input.
+ */
+void runner_input(Runner *r, int fd, void (*input)(Runner *r, void *data),
+		  void *data)
+{
+	r->input_fd = fd;
+	r->input = input;
+	r->input_data = data;
+}
+
+
+/**
+ * Trace how many hosts are running, when that or how many we allow has
+ * changed.
+ */
+static void trace_running(Runner *r, int allowed)
+{
+	if (r->fa->trace && (r->running->len != r->traced_running
+			     || allowed != r->traced_allowed)) {
+		r->traced_running = r->running->len;
+		r->traced_allowed = allowed;
+		trace_event(r->fa->trace, TRACE_RUNNING, NO_HOST,
+			    r->running->len, allowed);
+	}
+}
+
+
+/**
+ * How long until a host is due to be retried.
+ *
+ * @return ms, or -1 if there are no hosts to retry
+ */
+int runner_timeout(Runner *r)
+{
+	int wait = retry_wait(r);
+	gint64 now;
+
+	// Another Runner can make room in a group without waking us up.
+	if (r->claim && blocked_hosts(r)
+	    && (-1 == wait || wait > GROUP_RECHECK)) {
+		wait = GROUP_RECHECK;
+	}
+	if (! r->fa->timeout) {
+		return wait;
+	}
+	now = g_get_monotonic_time();
+	for (int i=0; i<r->running->len; i++) {
+		HostRun *hr = g_ptr_array_index(r->running, i);
+		gint64 due = hr->started + r->fa->timeout * (gint64) 1000;
+		int ms;
+		if (hr->killed > 1) {
+			continue;
+		} else if (hr->killed) {
+			due += KILL_GRACE * 1000;
+		}
+		ms = due <= now ? 0 : (due - now + 999) / 1000;
+		if (-1 == wait || ms < wait) {
+			wait = ms;
+		}
+	}
+	return wait;
+}
+
+
+/**
+ * How long until the first host on the retry queue is due.
+ *
+ * @return ms, or -1 if there are no hosts to retry
+ */
+static int retry_wait(Runner *r)
+{
+	HostRun *hr = g_queue_peek_head(r->retry);
+	gint64 now;
+
+	if (! hr) {
+		return -1;
+	}
+	now = g_get_monotonic_time();
+	if (hr->due <= now) {
+		return 0;
+	}
+	return (hr->due - now + 999) / 1000;
+}
+
+
+/**
+ * Stop steps that have run for longer than fa->timeout, with SIGTERM, and
+ * SIGKILL if that doesn't do it.  The child is a session leader, so this
+ * goes to everything it started.  The step then ends as usual when its pty
+ * closes.
+ */
+static void kill_late(Runner *r)
+{
+	gint64 now = g_get_monotonic_time();
+
+	for (int i=0; i<r->running->len; i++) {
+		HostRun *hr = g_ptr_array_index(r->running, i);
+		gint64 late = now - hr->started
+			- r->fa->timeout * (gint64) 1000;
+		if (late < 0) {
+			continue;
+		}
+		if (! hr->killed) {
+			kill(-hr->pid, SIGTERM);
+			hr->killed = 1;
+			hr->timed_out = TRUE;
+			TRACE(r->fa, TRACE_KILL, hr->id, SIGTERM, 0);
+		} else if (1 == hr->killed && late >= KILL_GRACE * 1000) {
+			kill(-hr->pid, SIGKILL);
+			hr->killed = 2;
+			TRACE(r->fa, TRACE_KILL, hr->id, SIGKILL, 0);
+		}
+	}
+}
 
 
 /**
- * Run a command on a host.
+ * The file descriptors to wait on for the running hosts, then the fifo that
+ * ssh says it has connected on with --trace, then the input if there is one.
+ * With epoll, the hosts are all behind one descriptor.
+ * They stay valid until the next runner_iterate().
  *
- * @ssh command to run to access the host.
+ * @param fds where to put a pointer to the pollfd array
+ * @return the number of pollfds
+ */
+int runner_pollfds(Runner *r, struct pollfd **fds)
+{
+	int n = r->running->len;
+
+	if (-1 != r->epfd) {
+		r->fds[0].fd = r->epfd;
+		r->fds[0].events = POLLIN;
+		r->fds[0].revents = 0;
+		n = 1;
+	} else {
+		for (int i=0; i<n; i++) {
+			HostRun *hr = g_ptr_array_index(r->running, i);
+			r->fds[i].fd = hr->fd;
+			r->fds[i].events = POLLIN;
+			r->fds[i].revents = 0;
+		}
+	}
+	if (r->fa->trace && -1 != r->fa->trace->connect_fd) {
+		r->fds[n].fd = r->fa->trace->connect_fd;
+		r->fds[n].events = POLLIN;
+		r->fds[n].revents = 0;
+		n ++;
+	}
+	if (-1 != r->input_fd) {
+		r->fds[n].fd = r->input_fd;
+		r->fds[n].events = POLLIN;
+		r->fds[n].revents = 0;
+		n ++;
+	}
+	*fds = r->fds;
+	return n;
+}
+
+
+/**
+ * Run each of the hosts, and return when they are all done.
+ *
+ * @see new_runner()
+ */
+void run_hosts(ForAll *fa, GArray *order, int parallel,
+	       RunOps *ops, void *data)
+{
+	Runner *r = new_runner(fa, order, parallel, ops, data);
+
+	while (runner_iterate(r, -1))
+		;
+	free_runner(r);
+}
+
+
+/**
+ * Start the next step that the host has.  If there are no more steps, the
+ * host is done and is freed.
  *
- * @ssh_options extra args for the ssh command.
+ * @return TRUE if a step is running, FALSE if the host is done
+ */
+static int start_step(Runner *r, HostRun *hr)
+{
+	while (1) {
+		int wanted = TRUE;
+		int started = 0;
+
+		// A host that waited for the budget has its step set up.
+		if (! hr->args) {
+			hr->args = g_ptr_array_new();
+			hr->in_fd = -1;
+			hr->out_fd = -1;
+			wanted = r->ops->step(hr, r->data);
+			if (wanted) {
+				ga(hr->args, NULL);
+			}
+		}
+		if (wanted) {
+			// If other hosts are running, one of them finishing
+			// will free up whatever we ran out of.
+			int others = others_running(r, hr);
+			gint64 spawn = g_get_monotonic_time();
+			started = run_command(r->fa, hr, others > 0);
+			if (started) {
+				watch_host(r, hr, WATCH_ADD);
+				TRACE(r->fa, TRACE_SPAWN, hr->id,
+				      hr->started - spawn, hr->step);
+			}
+			if (! started && others && budget_error(hr->error)) {
+				TRACE(r->fa, TRACE_WAIT, hr->id, hr->error, 0);
+				budget_exhausted(r->fa->budget, others,
+						 hr->error);
+				g_queue_push_tail(r->waiting, hr);
+				return FALSE;
+			}
+		}
+		g_ptr_array_free(hr->args, TRUE);
+		hr->args = 0;
+		if (-1 != hr->in_fd) {
+			close(hr->in_fd);
+		}
+		if (-1 != hr->out_fd) {
+			close(hr->out_fd);
+		}
+		if (started) {
+			return TRUE;
+		}
+		if (! wanted) {
+			break;
+		}
+		// We could not start the step.  Let step() see that.
+		hr->status = -1;
+		hr->step ++;
+	}
+
+	if (hr->groups) {
+		groups_give(r->fa->groups, hr->groups);
+		hr->groups = 0;
+	}
+	if (retry_host(r, hr)) {
+		return FALSE;
+	}
+	record_history(r->fa, hr);
+	TRACE(r->fa, TRACE_DONE, hr->id, 0, 0);
+	r->ops->done(hr, r->data);
+	if (! r->keep_hosts) {
+		free_host_run(hr);
+	}
+	return FALSE;
+}
+
+
+/**
+ * Note how long a host took, if we are keeping a history.
+ */
+void record_history(ForAll *fa, HostRun *hr)
+{
+	// How long it took only means something if the host ran the steps.
+	if (fa->history && -1 != hr->status
+	    && ! (WIFEXITED(hr->status) && 255 == WEXITSTATUS(hr->status))) {
+		history_record(fa->history, hr->host,
+			       g_get_monotonic_time() - hr->begun);
+	}
+}
+
+
+/**
+ * Free a host that is done.
+ */
+void free_host_run(HostRun *hr)
+{
+	if (hr->output) {
+		g_string_free(hr->output, TRUE);
+	}
+	if (hr->partial) {
+		g_string_free(hr->partial, TRUE);
+	}
+	if (hr->argbuf) {
+		g_string_free(hr->argbuf, TRUE);
+	}
+	g_free(hr);
+}
+
+
+/**
+ * If ssh could not reach the host, and we have retries left, put the host on
+ * the retry queue to start again from its first step.  A command that ran
+ * and failed is not retried.
+ *
+ * The delay doubles with each retry, and is spread over the second half of
+ * its range so that hosts that failed together don't retry together.
+ *
+ * @return TRUE if the host will be retried
+ */
+static int retry_host(Runner *r, HostRun *hr)
+{
+	gint64 delay;
+
+	if (hr->attempt >= r->fa->retries || -1 == hr->status
+	    || ! WIFEXITED(hr->status) || 255 != WEXITSTATUS(hr->status)) {
+		return FALSE;
+	}
+	delay = r->fa->retry_backoff;
+	for (int i=0; i<hr->attempt && delay < RETRY_BACKOFF_MAX; i++) {
+		delay *= 2;
+	}
+	delay = MIN(delay, RETRY_BACKOFF_MAX);
+	delay = delay / 2 + g_random_int_range(0, delay / 2 + 1);
+
+	hr->attempt ++;
+	hr->step = 0;
+	hr->status = -1;
+	hr->timed_out = FALSE;
+	hr->truncated = FALSE;
+	hr->due = g_get_monotonic_time() + delay * 1000;
+	TRACE(r->fa, TRACE_RETRY, hr->id, delay, 0);
+	if (r->fa->debug) {
+		fprintf(stderr, "%s: retry %d in %dms\n", hr->host,
+			hr->attempt, (int) delay);
+	}
+	g_queue_insert_sorted(r->retry, hr, compare_due, 0);
+	return TRUE;
+}
+
+
+/**
+ * How many hosts are running, apart from this one.
+ */
+static int others_running(Runner *r, HostRun *hr)
+{
+	for (int i=0; i<r->running->len; i++) {
+		if (hr == g_ptr_array_index(r->running, i)) {
+			return r->running->len - 1;
+		}
+	}
+	return r->running->len;
+}
+
+
+static gint compare_due(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const HostRun *ha = a;
+	const HostRun *hb = b;
+
+	if (ha->due == hb->due) {
+		return 0;
+	}
+	return ha->due < hb->due ? -1 : 1;
+}
+
+
+/**
+ * The current step's output has finished.  Collect the child, and go on to
+ * the next step.
+ *
+ * @return TRUE if another step is running, FALSE if the host is done
+ */
+static int end_step(Runner *r, HostRun *hr)
+{
+	pid_t pid2;
+	int wstatus;
+
+	TRACE(r->fa, TRACE_EXIT, hr->id, 0, 0);
+	if (r->fa->max_output) {
+		end_output(r, hr);
+	}
+	watch_host(r, hr, WATCH_DEL);
+	close(hr->fd);
+	hr->fd = -1;
+	do {
+		pid2 = waitpid(hr->pid, &wstatus, 0);
+	} while (-1 == pid2 && EINTR == errno);
+	assert(hr->pid == pid2);
+	TRACE(r->fa, TRACE_REAP, hr->id, wstatus, 0);
+	if (r->fa->adaptive && 0 == hr->step) {
+		Adaptive *a = r->fa->adaptive;
+		// We only know it wasn't ssh failing once the step is over, so
+		// that's when the response time counts.
+		if (WIFEXITED(wstatus) && 255 == WEXITSTATUS(wstatus)) {
+			adaptive_failure(a);
+		} else if (hr->first_output) {
+			adaptive_latency(a, hr->first_output - hr->started);
+		} else {
+			adaptive_latency(a, g_get_monotonic_time() - hr->started);
+		}
+	}
+	hr->status = wstatus;
+	hr->error = 0;
+	hr->step ++;
+	return start_step(r, hr);
+}
+
+
+/**
+ * Add a host's descriptor to the epoll set, or take it out.  Nothing to do
+ * with poll(), where runner_pollfds() lists them each time.
  *
- * @host where to run the following command.
+ * @param op WATCH_ADD or WATCH_DEL
+ */
+static void watch_host(Runner *r, HostRun *hr, int op)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	if (-1 == r->epfd) {
+		return;
+	}
+	ev.events = EPOLLIN;
+	ev.data.ptr = hr;
+	if (-1 == epoll_ctl(r->epfd, WATCH_ADD == op ? EPOLL_CTL_ADD
+			    : EPOLL_CTL_DEL, hr->fd, &ev)) {
+		fprintf(stderr, "epoll_ctl: %s\n", strerror(errno));
+		exit(5);
+	}
+#endif
+}
+
+
+/**
+ * Read what we can from a host.
  *
- * @command what to run on the host.
+ * @return TRUE if the host may have more output, FALSE at the end
  */
-void run_command(GString *ssh,
-		 GPtrArray *ssh_options,
-		 GString *host,
-		 GPtrArray *command,
-		 int opt_single,
-		 int opt_debug)
+static int read_host(Runner *r, HostRun *hr)
 {
-	pid_t pid;
-	/** args is an array of char*, not an array of GString*. */
-	GPtrArray *args = g_ptr_array_new();
+	char *p = r->buf;
+	int readval;
 
+	// Past the limit, there's nothing to be gained by reading slowly.
+	if (r->fa->max_output && hr->out_bytes >= r->fa->max_output) {
+		readval = read(hr->fd, p, DRAIN_SIZE);
+	} else {
+		readval = read(hr->fd, p, READ_SIZE);
+	}
+	if (readval > 0) {
+		if (! hr->first_output) {
+			hr->first_output = g_get_monotonic_time();
+			if (! hr->responded) {
+				hr->responded = hr->first_output;
+			}
+			TRACE(r->fa, TRACE_OUTPUT, hr->id, 0, 0);
+		}
+		hr->lastchar = p[readval-1];
+		r->fa->output_bytes += readval;
+		if (r->fa->max_output) {
+			capped_output(r, hr, p, readval);
+		} else {
+			r->ops->output(hr, p, readval, r->data);
+		}
+		return TRUE;
+	}
+	if (-1 == readval && (EAGAIN == errno || EINTR == errno)) {
+		return TRUE;
+	}
+	// 0 is end of file, and a pty gives us EIO when the child has gone.
+	return FALSE;
+}
+
+
+/**
+ * Pass on output from a step that is within --max-output.  With KEEP_HEAD
+ * the first part goes through as it comes.  With KEEP_TAIL the last part
+ * is kept in a ring until the step ends.  Anything else is dropped.
+ */
+static void capped_output(Runner *r, HostRun *hr, const char *buf, int len)
+{
+	gint64 max = r->fa->max_output;
+	gint64 head = 0;
+	gint64 tail = 0;
+	gint64 before = hr->out_bytes;
+
+	switch (r->fa->keep) {
+	case KEEP_HEAD:
+		head = max;
+		break;
+	case KEEP_TAIL:
+		tail = max;
+		break;
+	default:
+		head = max / 2;
+		tail = max - head;
+		break;
+	}
+	hr->out_bytes += len;
+	if (before < head) {
+		int n = MIN(len, head - before);
+		r->ops->output(hr, buf, n, r->data);
+		hr->lastpassed = buf[n-1];
+		buf += n;
+		len -= n;
+	}
+	if (! len) {
+		return;
+	}
+	if (! tail) {
+		hr->dropped += len;
+		return;
+	}
+	if (! hr->tail) {
+		hr->tail = g_string_sized_new(tail);
+		hr->tail_pos = 0;
+	}
+	// Only the last tail bytes of this lot can survive.
+	if (len > tail) {
+		hr->dropped += len - tail;
+		buf += len - tail;
+		len = tail;
+	}
+	while (len) {
+		int n;
+		if (hr->tail->len < tail) {
+			n = MIN(len, tail - hr->tail->len);
+			g_string_append_len(hr->tail, buf, n);
+		} else {
+			n = MIN(len, tail - hr->tail_pos);
+			memcpy(hr->tail->str + hr->tail_pos, buf, n);
+			hr->tail_pos = (hr->tail_pos + n) % tail;
+			hr->dropped += n;
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+
+/**
+ * A step's output has ended.  Say how much was dropped, and pass on what the
+ * ring kept.
+ */
+static void end_output(Runner *r, HostRun *hr)
+{
+	if (hr->dropped) {
+		GString *gs = g_string_new("");
+		g_string_printf(gs, "%s[%s: %" G_GINT64_FORMAT
+				" bytes of output dropped]\r\n",
+				! hr->lastpassed || '\n' == hr->lastpassed ? ""
+				: '\r' == hr->lastpassed ? "\n" : "\r\n",
+				r->fa->name, hr->dropped);
+		r->ops->output(hr, gs->str, gs->len, r->data);
+		g_string_free(gs, TRUE);
+		hr->truncated = TRUE;
+		if (! hr->tail) {
+			hr->lastchar = '\n';
+		}
+	}
+	if (hr->tail) {
+		GString *t = hr->tail;
+		// The oldest byte is at tail_pos once the ring has gone round.
+		r->ops->output(hr, t->str + hr->tail_pos, t->len - hr->tail_pos,
+			       r->data);
+		if (hr->tail_pos) {
+			r->ops->output(hr, t->str, hr->tail_pos, r->data);
+		}
+		g_string_free(t, TRUE);
+		hr->tail = 0;
+	}
+	hr->dropped = 0;
+	hr->lastpassed = '\0';
+}
+
+
+/**
+ * Start one step on a host, in a new pty.
+ *
+ * @return TRUE if the child is running, FALSE if not, with hr->error set.
+ */
+static int run_command(ForAll *fa, HostRun *hr, int can_wait)
+{
 	int ptfd;
-	char *slavename;
-
-	ga(args, g2c(ssh));
-	g_ptr_array_add(args, "-n");
-	g_ptr_array_add(args, "-q");
-	g_ptr_array_add(args, "-t");
-	for (int i=0; i<ssh_options->len; i++) {
-		g_ptr_array_add(args, "-o");
-		ga(args, a2g2c(ssh_options, i));
-	}
-	ga(args, g2c(host));
-	ga(args, "--");
-	for (int i=0; i<command->len; i++) {
-		ga(args, a2g2c(command, i));
-	}
-	ga(args, NULL);
-
-	if (! opt_quiet && ! opt_single) {
-		//printf("-- rc: args->len=%d\n", args->len);
-		//printf("-- rc: args...\n");
-		for (int i=0;
-		     i<(args->len)-1; /* -1 so we don't print the NULL. */
-		     i++) {
-			if (i) printf(" ");
-			if (opt_debug)
-				printf("{");
-			printf("%s", a2c(args, i));
-			if (opt_debug)
-				printf("}");
-		}
-		printf("\n");
-	}
-
-	GString *gs = g_string_new("");
-
-	ptfd = posix_openpt(O_RDWR);
+	int slave;
+	char slavename[64];
+	char *prog = a2c(hr->args, 0);
+
+	if (fa->no_pty) {
+		return run_pipe(fa, hr, can_wait);
+	}
+	// Other children must not hold on to this host's pty, even ones that
+	// another thread starts before we get as far as forking.
+	ptfd = posix_openpt(O_RDWR | O_NOCTTY | PTY_CLOEXEC);
+	if (-1 == ptfd) {
+		hr->error = errno;
+		if (! can_wait || ! budget_error(hr->error)) {
+			fprintf(stderr, "%s # Cannot open pty: %s\n",
+				hr->host, strerror(hr->error));
+		}
+		return FALSE;
+	}
 	grantpt(ptfd);
 	unlockpt(ptfd);
-	slavename = ptsname(ptfd);
-	if (opt_debug) {
-		printf("pty = %s\n", slavename);
+	// Not ptsname(), which has one buffer for all the threads, so another
+	// thread's pty name can turn up in it before we open ours.
+	if (ptsname_r(ptfd, slavename, sizeof(slavename))) {
+		// Then the open() fails, and says so.
+		slavename[0] = '\0';
+	}
+	if (fa->debug) {
+		fprintf(stderr, "pty = %s\n", slavename);
+	}
+	// Open the slave here, so that running out of descriptors is our
+	// problem and not a child that exits before the pty is ever used.
+	slave = open(slavename, O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (-1 == slave) {
+		hr->error = errno;
+		if (! can_wait || ! budget_error(hr->error)) {
+			fprintf(stderr, "%s # Cannot open %s: %s\n",
+				hr->host, slavename, strerror(hr->error));
+		}
+		close(ptfd);
+		return FALSE;
 	}
+	// In case posix_openpt() could not do it.
+	fcntl(ptfd, F_SETFD, FD_CLOEXEC);
 
-	pid = fork();
-	switch (pid) {
+	// Don't let the child inherit anything waiting in stdio.
+	fflush(stdout);
+	fflush(stderr);
+	hr->pid = fork();
+	switch (hr->pid) {
 	case -1:
 		// Error.
-		g_string_printf(gs, "%s # Cannot fork: %s", host->str,
-				strerror(errno));
-		fprintf(stderr, "%s\n", gs->str);
-		failure(gs);
-		break;
+		hr->error = errno;
+		if (! can_wait || ! budget_error(hr->error)) {
+			fprintf(stderr, "%s # Cannot fork: %s\n",
+				hr->host, strerror(hr->error));
+		}
+		close(ptfd);
+		close(slave);
+		return FALSE;
 	case 0:
 		// I am the child.
-		run_child(slavename, ssh->str, (char **) args->pdata);
+		run_child(slave, prog, (char **) hr->args->pdata,
+			  hr->in_fd, hr->out_fd);
 		// run_child() does not return.
 	default:
 		// I am the parent.
-		run_parent(ptfd, ssh, host, pid);
 		break;
 	}
 
-	g_ptr_array_free(args, TRUE);
+	close(slave);
+	step_started(hr, ptfd);
+	return TRUE;
 }
 
 
-static void run_child(char *slavename, char *prog, char **argp)
+/**
+ * Start a step with its output and errors on a pipe, instead of a pty, for
+ * -T.  There is no pty to open and set up, and posix_spawn() does not copy
+ * our page tables the way fork() does, which adds up when we are running
+ * thousands of hosts.
+ */
+static int run_pipe(ForAll *fa, HostRun *hr, int can_wait)
 {
+	extern char **environ;
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	char *prog = a2c(hr->args, 0);
+	int fds[2];
 	int err;
-	int fd;
 
-	fd = open(slavename, O_RDWR);
-	err = errno;
-	if (-1 == fd) {
-		fprintf(stderr, "Cannot open %s: %s\n", slavename,
-			strerror(err));
-		exit(128);
+#ifdef __linux__
+	if (-1 == pipe2(fds, O_CLOEXEC)) {
+#else
+	if (-1 == pipe(fds)) {
+#endif
+		hr->error = errno;
+		if (! can_wait || ! budget_error(hr->error)) {
+			fprintf(stderr, "%s # Cannot make a pipe: %s\n",
+				hr->host, strerror(hr->error));
+		}
+		return FALSE;
+	}
+	// Only of use where there's no pipe2(), as another thread may fork
+	// first.
+	fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+
+	posix_spawn_file_actions_init(&actions);
+	if (-1 != hr->in_fd) {
+		posix_spawn_file_actions_adddup2(&actions, hr->in_fd, 0);
+	} else {
+		posix_spawn_file_actions_addopen(&actions, 0, "/dev/null",
+						 O_RDONLY, 0);
+	}
+	posix_spawn_file_actions_adddup2(&actions, -1 != hr->out_fd
+					 ? hr->out_fd : fds[1], 1);
+	posix_spawn_file_actions_adddup2(&actions, fds[1], 2);
+	posix_spawnattr_init(&attr);
+#ifdef POSIX_SPAWN_SETSID
+	// With no controlling tty, ssh can't stop to ask for a password.
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID);
+#else
+	// kill_late() signals the process group.
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+	posix_spawnattr_setpgroup(&attr, 0);
+#endif
+	err = posix_spawnp(&hr->pid, prog, &actions, &attr,
+			   (char **) hr->args->pdata, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	close(fds[1]);
+	if (err) {
+		hr->error = err;
+		if (! can_wait || ! budget_error(hr->error)) {
+			fprintf(stderr, "%s # Cannot run %s: %s\n",
+				hr->host, prog, strerror(hr->error));
+		}
+		close(fds[0]);
+		return FALSE;
 	}
+	step_started(hr, fds[0]);
+	return TRUE;
+}
+
+
+/**
+ * A step's child is running, and fd has its output.
+ */
+static void step_started(HostRun *hr, int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	hr->fd = fd;
+	hr->lastchar = '\0';
+	hr->started = g_get_monotonic_time();
+	hr->first_output = 0;
+	hr->killed = 0;
+	hr->out_bytes = 0;
+}
+
+
+static void run_child(int slave, char *prog, char **argp,
+		      int in_fd, int out_fd)
+{
+	int err;
+
 	// Make in, out, err, point to the pty.
-	dup2(fd, 2);
-	dup2(fd, 1);
-	dup2(fd, 0);
-	close(fd);
+	dup2(slave, 2);
+	dup2(slave, 1);
+	dup2(slave, 0);
+	close(slave);
+	// Unless the step wants its own in or out.
+	if (-1 != in_fd) {
+		dup2(in_fd, 0);
+		close(in_fd);
+	}
+	if (-1 != out_fd) {
+		dup2(out_fd, 1);
+		close(out_fd);
+	}
 	if (-1 == setsid()) {
 		fprintf(stderr, "setsid: %s\n", strerror(errno));
-		exit(4);
+		_exit(4);
 	}
-	if (-1 == ioctl(0, TIOCSCTTY, 1)) {
+	if (-1 == ioctl(2, TIOCSCTTY, 1)) {
 		fprintf(stderr, "ioctl: %s\n", strerror(errno));
-		exit(4);
+		_exit(4);
 	}
 	execvp(prog, argp);
 
 	// We shouldn't get here under normal circumstances.
 	err = errno;
 	fprintf(stderr, "Cannot exec %s: %s\n", prog, strerror(err));
-	// This exit code appears in the parent's WEXITSTATUS.
-	exit(128);
+	// This exit code appears in the parent's WEXITSTATUS.  _exit(), so
+	// that we don't write out a copy of what another thread had buffered.
+	_exit(128);
 }
 
 
-void run_parent(int fd, GString *prog, GString *host, pid_t pid)
+/**
+ * Record how a host went in the status table, according to how its last
+ * step went.
+ *
+ * @param fa where the status table is
+ * @param hr the host
+ * @param ok the reason to give if it succeeded, RESULT_OK or RESULT_UNCHANGED
+ */
+void record_result(ForAll *fa, HostRun *hr, HostReason ok)
 {
-	int readval;
-	int writeval;
-	int written;
-	static ssize_t bufsize = 256;
-	unsigned char buf[bufsize];
-	unsigned char lastchar = '\0';
-	GString *gs;
-	int ret;
-	pid_t pid2;
-	int wstatus;
+	HostStatus st = { 0 };
+	int wstatus = hr->status;
+	gint64 now = g_get_monotonic_time();
 
-	fflush(stdout);
-	while (-1 != (readval=read(fd, buf, bufsize))) {
-		if (0 == readval) {
-			break;
-		}
-		written = 0;
-		while (written < readval) {
-			writeval = write(1, buf+written, readval-written);
-			if (-1 == writeval) {
-				exit(5);
-			}
-			written += writeval;
-		}
-		lastchar = buf[readval-1];
+	if (hr->truncated) {
+		st.flags |= STATUS_TRUNCATED;
 	}
-	/* Detect if the last line of output (if there was any output) was
-	   terminated by a newline. If there was no output, or the last
-	   character was not a newline, add a newline. Don't do this if -q was
-	   specified. */
-	if (! opt_quiet && '\n' != lastchar) {
-		writeval = write(1, "\n", 1);
-		if (-1 == writeval) {
-			exit(5);
-		}
-	}
-
-	gs = g_string_new("");
-	pid2 = wait(&wstatus);
-	assert(pid == pid2);
-	ret = WEXITSTATUS(wstatus);
-	switch (ret) {
+	if (hr->timed_out) {
+		st.reason = RESULT_TIMEOUT;
+	} else if (-1 == wstatus) {
+		st.reason = RESULT_NO_START;
+		st.error = hr->error;
+	} else if (WIFSIGNALED(wstatus)) {
+		st.reason = RESULT_SIGNAL;
+		st.code = WTERMSIG(wstatus);
+	} else switch (WEXITSTATUS(wstatus)) {
 	case 0:
-		g_string_printf(gs, "%s", host->str);
-		success(gs);
+		st.reason = ok;
 		break;
 	case 128:
-		g_string_printf(gs, "%-*s# Cannot exec %s",
-				host_len(), host->str, prog->str);
-		failure(gs);
+		st.reason = RESULT_NO_EXEC;
 		break;
 	default:
-		g_string_printf(gs, "%-*s # (%d)",
-				host_len(), host->str, ret);
-		failure(gs);
+		st.reason = RESULT_EXIT;
+		st.code = WEXITSTATUS(wstatus);
 		break;
 	}
+	if (hr->begun) {
+		st.start_ms = (hr->begun - fa->started) / 1000;
+		st.ms = (now - hr->begun) / 1000;
+	}
+	if (hr->responded) {
+		st.first_ms = MAX(1, (hr->responded - hr->begun) / 1000);
+	}
+	set_status(fa, hr->id, &st);
 }
-
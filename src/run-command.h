@@ -3,15 +3,139 @@
 
 #include <glib.h>
 #include <stdio.h>
+#include <poll.h>
+#include <sys/types.h>
 
+#include "context.h"
+#include "results.h"
+#include "template.h"
 
 
-void run_command(GString *ssh,
-		 GPtrArray *ssh_options,
-		 GString *host,
-		 GPtrArray *command,
-		 int opt_single,
-		 int opt_debug);
+/**
+ * One host that we are working on.  A host runs one or more steps (eg a
+ * checksum and then a copy), and each step is one child process.
+ */
+struct _hostRun {
+	int index;		/* Index of the host in the hosts list */
+	int slot;		/* Where the host is in the running list */
+	HostId id;		/* Id of the host's name */
+	const char *host;	/* Host name, owned by the context */
+	int step;		/* Which step we're up to, from 0 */
+	GPtrArray *args;	/* argv (char*) for the step, NULL terminated */
+	GString *argbuf;	/* The words in args that host_args() filled in */
+	int in_fd;		/* stdin for the step, or -1 for the pty */
+	int out_fd;		/* stdout for the step, or -1 for the pty */
+	pid_t pid;
+	int fd;			/* pty master */
+	int status;		/* wait() status of the last step, or -1 */
+	int error;		/* errno if we could not start the step */
+	unsigned char lastchar;	/* Last character of output seen */
+	gint64 begun;		/* When the host's first step started */
+	gint64 started;		/* When the step started */
+	gint64 first_output;	/* When the step first had output, or 0 */
+	gint64 responded;	/* When the host first had output, or 0 */
+	GString *output;	/* Output held back until the host is done */
+	GString *partial;	/* Start of a line that has no newline yet */
+	int attempt;		/* How many times we've retried the host */
+	int killed;		/* Signals sent to the step, for --timeout */
+	int timed_out;		/* A step ran for too long */
+	gint64 out_bytes;	/* Output from the step, for --max-output */
+	gint64 dropped;		/* Output we didn't pass on */
+	GString *tail;		/* Ring of the step's last output */
+	int tail_pos;		/* Where the ring's next byte goes */
+	unsigned char lastpassed; /* Last character passed on, or 0 */
+	int truncated;		/* Some output was dropped */
+	gint64 due;		/* When the retry can start */
+	GPtrArray *groups;	/* What it took from its groups, or NULL */
+	int skipped;		/* A -N list excluded it before it started */
+	void *data;		/* Per-host data for the RunOps */
+};
+typedef struct _hostRun HostRun;
+
+
+/**
+ * What to do with each host.  step() is called before each step, with
+ * hr->step counting from 0 and hr->status holding the previous step's wait()
+ * status.  It fills in hr->args and returns TRUE, or returns FALSE when the
+ * host has nothing more to do, at which point done() is called.
+ */
+struct _runOps {
+	int  (*step)(HostRun *hr, void *data);
+	void (*output)(HostRun *hr, const char *buf, int len, void *data);
+	void (*done)(HostRun *hr, void *data);
+};
+typedef struct _runOps RunOps;
+
+
+/**
+ * A set of hosts being run.  The caller drives it with runner_iterate(),
+ * either letting that wait in poll(), or polling the runner_pollfds() in its
+ * own loop and then calling runner_iterate() with no timeout, after at most
+ * runner_timeout().
+ */
+typedef struct _runner Runner;
+
+struct _runner {
+	ForAll *fa;
+	GArray *order;		/* Indexes (int) into the hosts list */
+	int next;		/* Next host in order to start */
+	gint *claim;		/* Or the next host, shared with other Runners */
+	int keep_hosts;		/* done() frees hosts, with free_host_run(),
+				   and is given skipped hosts too */
+	int parallel;		/* The most hosts to run at once */
+	GPtrArray *running;	/* HostRun* */
+	struct pollfd *fds;	/* One for each running host, or the epfd */
+	int epfd;		/* epoll descriptor, or -1 to use poll() */
+	struct epoll_event *events; /* From epoll_wait() */
+	GQueue *retry;		/* HostRun*, waiting to retry, soonest first */
+	GQueue *waiting;	/* HostRun*, waiting for the budget to start */
+	GQueue *blocked;	/* HostRun*, waiting for room in their groups */
+	int blocked_max;	/* Take no more from the order with this many
+				   blocked */
+	GMutex *lock;		/* Or NULL; for blocked, if other Runners
+				   share it */
+	gint *all_running;	/* Or NULL; hosts running in all the Runners
+				   sharing the order */
+	gint freed_seen;	/* groups->freed when we last looked at them */
+	int held;		/* The budget is holding hosts back */
+	int traced_running;	/* What we last traced, so we trace changes */
+	int traced_allowed;
+	int input_fd;		/* More hosts come from here, or -1 */
+	void (*input)(Runner *r, void *data);	/* Called when it's readable */
+	void *input_data;
+	RunOps *ops;
+	void *data;		/* For the RunOps */
+	GDestroyNotify free_data;	/* For data, in free_runner() */
+	char *buf;		/* For reading from the hosts */
+};
+
+
+/* Flags for ssh_template(). */
+#define SSH_NO_STDIN	0x01	/* -n */
+#define SSH_TTY		0x02	/* -t, otherwise -T */
+#define SSH_MUX		0x04	/* Share one connection per host */
+
+/* What --max-output keeps, in fa->keep. */
+#define KEEP_BOTH	0	/* The start and the end */
+#define KEEP_HEAD	1	/* The start */
+#define KEEP_TAIL	2	/* The end */
+
+Template *ssh_template(ForAll *fa, int flags);
+void host_args(ForAll *fa, HostRun *hr, Template *t);
+Runner *new_runner(ForAll *fa, GArray *order, int parallel,
+		   RunOps *ops, void *data);
+int runner_iterate(Runner *r, int timeout);
+void runner_add(Runner *r, int index);
+void runner_input(Runner *r, int fd, void (*input)(Runner *r, void *data),
+		  void *data);
+int runner_pollfds(Runner *r, struct pollfd **fds);
+int runner_timeout(Runner *r);
+void free_runner(Runner *r);
+void run_hosts(ForAll *fa, GArray *order, int parallel,
+	       RunOps *ops, void *data);
+void record_result(ForAll *fa, HostRun *hr, HostReason ok);
+void record_history(ForAll *fa, HostRun *hr);
+void free_host_run(HostRun *hr);
 
 
 
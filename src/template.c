@@ -0,0 +1,173 @@
+/*
+ * Argument lists with per-host parts.  A word can have %h (the host name),
+ * %i (the host's index in the host list, from 0) and %u (the user), and %%
+ * is a %.  Anything else after a % is left alone.  Words that must not be
+ * touched, such as -o options with ssh's own % tokens, are added with
+ * template_add_literal().
+ *
+ * The words are split up when they are added, so filling in a host only
+ * copies the words that have something to fill in.  The rest go into the
+ * argument list as they are.
+ */
+
+#include <glib.h>
+#include <string.h>
+
+#include "template.h"
+#include "utils.h"
+
+
+static GArray *compile_word(const char *text);
+static void free_word(gpointer data);
+
+
+Template *new_template(void)
+{
+	Template *t = g_new0(Template, 1);
+
+	t->words = g_ptr_array_new_with_free_func(free_word);
+	return t;
+}
+
+
+void free_template(Template *t)
+{
+	g_ptr_array_free(t->words, TRUE);
+	g_free(t);
+}
+
+
+/**
+ * Add a word that can have %h, %i and %u in it.
+ */
+void template_add(Template *t, const char *word)
+{
+	TemplateWord *w = g_new0(TemplateWord, 1);
+
+	w->text = g_strdup(word);
+	w->parts = compile_word(w->text);
+	ga(t->words, w);
+}
+
+
+/**
+ * Add a word that is used just as it is.
+ */
+void template_add_literal(Template *t, const char *word)
+{
+	TemplateWord *w = g_new0(TemplateWord, 1);
+
+	w->text = g_strdup(word);
+	ga(t->words, w);
+}
+
+
+/**
+ * Add the words for one host to an argument list.  The words that were
+ * filled in are kept in buf, so they last until buf is next used.
+ *
+ * @param args array of char* to add to
+ * @param buf holds the filled in words, and is emptied first
+ */
+void template_fill(Template *t, const TemplateVars *v,
+		   GPtrArray *args, GString *buf)
+{
+	gsize pos = 0;
+
+	g_string_truncate(buf, 0);
+	// Fill them all in first, as buf can move while it grows.
+	for (int i=0; i<t->words->len; i++) {
+		TemplateWord *w = g_ptr_array_index(t->words, i);
+		if (! w->parts) {
+			continue;
+		}
+		for (int j=0; j<w->parts->len; j++) {
+			TemplatePart *p = &g_array_index(w->parts,
+							 TemplatePart, j);
+			g_string_append_len(buf, w->text + p->start, p->len);
+			switch (p->var) {
+			case VAR_HOST:
+				g_string_append(buf, v->host);
+				break;
+			case VAR_INDEX:
+				g_string_append_printf(buf, "%d", v->index);
+				break;
+			case VAR_USER:
+				g_string_append(buf, v->user);
+				break;
+			}
+		}
+		g_string_append_c(buf, '\0');
+	}
+	for (int i=0; i<t->words->len; i++) {
+		TemplateWord *w = g_ptr_array_index(t->words, i);
+		if (w->parts) {
+			ga(args, buf->str + pos);
+			pos += strlen(buf->str + pos) + 1;
+		} else {
+			ga(args, w->text);
+		}
+	}
+}
+
+
+/**
+ * Split a word into parts at each %h, %i, %u and %%.
+ *
+ * @return the parts, or NULL if the word is used as it is
+ */
+static GArray *compile_word(const char *text)
+{
+	GArray *parts = 0;
+	TemplatePart part = { 0, 0, VAR_NONE };
+
+	for (guint32 i=0; text[i]; i++) {
+		int var;
+		if ('%' != text[i]) {
+			continue;
+		}
+		switch (text[i+1]) {
+		case 'h':
+			var = VAR_HOST;
+			break;
+		case 'i':
+			var = VAR_INDEX;
+			break;
+		case 'u':
+			var = VAR_USER;
+			break;
+		case '%':
+			var = VAR_NONE;
+			break;
+		default:
+			continue;
+		}
+		if (! parts) {
+			parts = g_array_new(FALSE, FALSE, sizeof(TemplatePart));
+		}
+		// For %%, the text takes in the first %.
+		part.len = i - part.start + (VAR_NONE == var);
+		part.var = var;
+		g_array_append_val(parts, part);
+		i++;
+		part.start = i + 1;
+	}
+	if (parts) {
+		part.len = strlen(text) - part.start;
+		part.var = VAR_NONE;
+		g_array_append_val(parts, part);
+	}
+	return parts;
+}
+
+
+static void free_word(gpointer data)
+{
+	TemplateWord *w = (TemplateWord *) data;
+
+	g_free(w->text);
+	if (w->parts) {
+		g_array_free(w->parts, TRUE);
+	}
+	g_free(w);
+}
@@ -0,0 +1,62 @@
+#ifndef template_h_INCLUDED
+#define template_h_INCLUDED
+
+#include <glib.h>
+
+
+/** What goes in place of a % in a word. */
+enum _templateVar {
+	VAR_NONE,		/* Just the text */
+	VAR_HOST,		/* %h */
+	VAR_INDEX,		/* %i */
+	VAR_USER,		/* %u */
+};
+typedef enum _templateVar TemplateVar;
+
+
+/**
+ * A piece of a word: some of its text, then a variable.
+ */
+struct _templatePart {
+	guint32 start;		/* Where the text starts in the word */
+	guint32 len;
+	guint32 var;		/* TemplateVar */
+};
+typedef struct _templatePart TemplatePart;
+
+
+struct _templateWord {
+	char *text;
+	GArray *parts;		/* TemplatePart, or NULL if there's no % */
+};
+typedef struct _templateWord TemplateWord;
+
+
+/**
+ * An argument list that is worked out once, and filled in for each host.
+ */
+struct _template {
+	GPtrArray *words;	/* TemplateWord* */
+};
+typedef struct _template Template;
+
+
+/** The values for one host. */
+struct _templateVars {
+	const char *host;
+	int index;
+	const char *user;
+};
+typedef struct _templateVars TemplateVars;
+
+
+// template.c
+Template *new_template(void);
+void free_template(Template *t);
+void template_add(Template *t, const char *word);
+void template_add_literal(Template *t, const char *word);
+void template_fill(Template *t, const TemplateVars *v,
+		   GPtrArray *args, GString *buf);
+
+
+#endif // template_h_INCLUDED
@@ -0,0 +1,326 @@
+/*
+ * Record what happens in a run, and write it out in the Chrome trace event
+ * format, which Perfetto (ui.perfetto.dev) and chrome://tracing can show.
+ * Each host gets a row with its run and its steps, and a "scheduler" row
+ * has how many hosts were running against how many we allowed.
+ *
+ * Recording an event is just filling in a slot in a ring, so it costs
+ * little enough to leave on for big runs.  All the formatting is done when
+ * the trace is written.
+ *
+ * ssh doesn't tell us when it has connected, but it runs its LocalCommand
+ * then.  ssh_template() has that write the host's index to a fifo that the
+ * Runners wait on along with the hosts.
+ */
+
+#define _GNU_SOURCE		/* O_CLOEXEC, mkfifo() */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+#include "bitset.h"
+
+
+static void append_event(GString *gs, Trace *t, TraceEvent *e,
+			 Bitset *host_open, Bitset *step_open);
+static void append_json_string(GString *gs, const char *s);
+static void make_connect_fifo(Trace *t);
+
+
+/**
+ * @param size how many events to keep, at most.  The ring only takes the
+ * memory for the events there have been.
+ */
+Trace *new_trace(guint32 size)
+{
+	Trace *t = g_new0(Trace, 1);
+
+	t->size = TRACE_CHUNK;
+	while (t->size < size && t->size < (1U << 30)) {
+		t->size <<= 1;
+	}
+	t->chunks = g_new0(TraceEvent *, t->size / TRACE_CHUNK);
+	t->start = g_get_monotonic_time();
+	g_mutex_init(&t->connect_lock);
+	make_connect_fifo(t);
+	return t;
+}
+
+
+void free_trace(Trace *t)
+{
+	if (t->connect_fifo) {
+		gchar *dir = g_path_get_dirname(t->connect_fifo);
+		close(t->connect_fd);
+		unlink(t->connect_fifo);
+		rmdir(dir);
+		g_free(dir);
+		g_free(t->connect_fifo);
+		g_string_free(t->connect_buf, TRUE);
+	}
+	g_mutex_clear(&t->connect_lock);
+	for (guint32 i=0; i<t->size / TRACE_CHUNK; i++) {
+		g_free(t->chunks[i]);
+	}
+	g_free(t->chunks);
+	g_free(t);
+}
+
+
+/**
+ * Make the fifo for ssh to say it has connected.  Without it, there are no
+ * connect events, and that's all.
+ */
+static void make_connect_fifo(Trace *t)
+{
+	gchar *dir = g_dir_make_tmp("for-all-XXXXXX", 0);
+
+	t->connect_fd = -1;
+	if (! dir) {
+		return;
+	}
+	t->connect_fifo = g_build_filename(dir, "connect", NULL);
+	// Open for writing too, so we never see the end of it.
+	if (-1 == mkfifo(t->connect_fifo, 0600)
+	    || -1 == (t->connect_fd = open(t->connect_fifo, O_RDWR
+					   | O_NONBLOCK | O_CLOEXEC))) {
+		unlink(t->connect_fifo);
+		rmdir(dir);
+		g_free(t->connect_fifo);
+		t->connect_fifo = 0;
+	} else {
+		t->connect_buf = g_string_new("");
+	}
+	g_free(dir);
+}
+
+
+void trace_event(Trace *t, TraceKind kind, HostId host, gint32 a, gint32 b)
+{
+	guint32 slot = (guint32) g_atomic_int_add(&t->next, 1) & (t->size - 1);
+	TraceEvent **chunk = &t->chunks[slot / TRACE_CHUNK];
+	TraceEvent *c = g_atomic_pointer_get(chunk);
+	TraceEvent *e;
+
+	if (! c) {
+		// Another thread may be making the same chunk.
+		c = g_new(TraceEvent, TRACE_CHUNK);
+		if (! g_atomic_pointer_compare_and_exchange(chunk, NULL, c)) {
+			g_free(c);
+			c = g_atomic_pointer_get(chunk);
+		}
+	}
+	e = &c[slot % TRACE_CHUNK];
+	e->ts = g_get_monotonic_time() - t->start;
+	e->host = host;
+	e->kind = kind;
+	e->a = a;
+	e->b = b;
+}
+
+
+/**
+ * Note a connect event for each host whose ssh has written its index to the
+ * fifo.  A Runner calls this when the fifo is readable.  Only one thread
+ * reads it at a time, so that the lines come whole; the others can carry
+ * on, as that one reads all there is.
+ *
+ * @param hosts HostId, by index, for the indexes in the fifo
+ */
+void trace_connects(Trace *t, GArray *hosts)
+{
+	char buf[512];
+	ssize_t n;
+
+	if (! g_mutex_trylock(&t->connect_lock)) {
+		return;
+	}
+	while ((n = read(t->connect_fd, buf, sizeof(buf))) > 0) {
+		char *line;
+		char *nl;
+
+		g_string_append_len(t->connect_buf, buf, n);
+		line = t->connect_buf->str;
+		while ((nl = strchr(line, '\n'))) {
+			long i = strtol(line, 0, 10);
+			if (i >= 0 && i < (long) hosts->len) {
+				trace_event(t, TRACE_CONNECT,
+					    g_array_index(hosts, HostId, i),
+					    0, 0);
+			}
+			line = nl + 1;
+		}
+		g_string_erase(t->connect_buf, 0, line - t->connect_buf->str);
+	}
+	g_mutex_unlock(&t->connect_lock);
+}
+
+
+/**
+ * Write the events to a file as JSON.
+ *
+ * @return TRUE, or FALSE with error set
+ */
+int write_trace(Trace *t, Names *names, const char *filename,
+		GError **error)
+{
+	GString *gs = g_string_new("{\"traceEvents\":[\n");
+	Bitset *named = new_bitset();
+	Bitset *host_open = new_bitset();
+	Bitset *step_open = new_bitset();
+	guint32 total = g_atomic_int_get(&t->next);
+	guint32 count = MIN(total, t->size);
+	int ret;
+
+	g_string_append(gs, "{\"name\":\"thread_name\",\"ph\":\"M\","
+			"\"pid\":1,\"tid\":0,"
+			"\"args\":{\"name\":\"scheduler\"}}");
+	for (guint32 i=total-count; i!=total; i++) {
+		guint32 slot = i & (t->size - 1);
+		TraceEvent *e = &t->chunks[slot / TRACE_CHUNK][slot % TRACE_CHUNK];
+		if (NO_HOST != e->host && ! bitset_has(named, e->host)) {
+			bitset_add(named, e->host);
+			g_string_append_printf(gs, ",\n{\"name\":\"thread_name\","
+					       "\"ph\":\"M\",\"pid\":1,"
+					       "\"tid\":%u,\"args\":{\"name\":",
+					       e->host + 1);
+			append_json_string(gs, name_of(names, e->host));
+			g_string_append(gs, "}}");
+		}
+		append_event(gs, t, e, host_open, step_open);
+	}
+	g_string_append_printf(gs, "\n],\"displayTimeUnit\":\"ms\","
+			       "\"otherData\":{\"lost_events\":\"%u\"}}\n",
+			       total - count);
+	ret = g_file_set_contents(filename, gs->str, gs->len, error);
+	g_string_free(gs, TRUE);
+	free_bitset(named);
+	free_bitset(host_open);
+	free_bitset(step_open);
+	return ret;
+}
+
+
+/**
+ * Add one event.  The start of a host or step may have fallen off the ring,
+ * so ends are only written for what we saw start.
+ */
+static void append_event(GString *gs, Trace *t, TraceEvent *e,
+			 Bitset *host_open, Bitset *step_open)
+{
+	guint32 tid = NO_HOST == e->host ? 0 : e->host + 1;
+	const char *instant = 0;
+
+	switch (e->kind) {
+	case TRACE_HOST:
+		bitset_add(host_open, e->host);
+		g_string_append_printf(gs, ",\n{\"name\":\"host\",\"ph\":\"B\","
+				       "\"pid\":1,\"tid\":%u,"
+				       "\"ts\":%" G_GINT64_FORMAT "}",
+				       tid, e->ts);
+		break;
+	case TRACE_SPAWN:
+		bitset_add(step_open, e->host);
+		g_string_append_printf(gs, ",\n{\"name\":\"spawn\",\"ph\":\"X\","
+				       "\"pid\":1,\"tid\":%u,"
+				       "\"ts\":%" G_GINT64_FORMAT ",\"dur\":%d}",
+				       tid, e->ts - e->a, e->a);
+		g_string_append_printf(gs, ",\n{\"name\":\"step %d\","
+				       "\"ph\":\"B\",\"pid\":1,\"tid\":%u,"
+				       "\"ts\":%" G_GINT64_FORMAT "}",
+				       e->b, tid, e->ts);
+		break;
+	case TRACE_REAP:
+		if (bitset_has(step_open, e->host)) {
+			bitset_remove(step_open, e->host);
+			g_string_append_printf(gs, ",\n{\"ph\":\"E\",\"pid\":1,"
+					       "\"tid\":%u,"
+					       "\"ts\":%" G_GINT64_FORMAT ","
+					       "\"args\":{\"status\":%d}}",
+					       tid, e->ts, e->a);
+		}
+		break;
+	case TRACE_DONE:
+		if (bitset_has(host_open, e->host)) {
+			bitset_remove(host_open, e->host);
+			g_string_append_printf(gs, ",\n{\"ph\":\"E\",\"pid\":1,"
+					       "\"tid\":%u,"
+					       "\"ts\":%" G_GINT64_FORMAT "}",
+					       tid, e->ts);
+		}
+		break;
+	case TRACE_RUNNING:
+		g_string_append_printf(gs, ",\n{\"name\":\"hosts\",\"ph\":\"C\","
+				       "\"pid\":1,\"tid\":0,"
+				       "\"ts\":%" G_GINT64_FORMAT ","
+				       "\"args\":{\"running\":%d,"
+				       "\"allowed\":%d}}",
+				       e->ts, e->a, e->b);
+		break;
+	case TRACE_OUTPUT:
+		instant = "first output";
+		break;
+	case TRACE_CONNECT:
+		instant = "connect";
+		break;
+	case TRACE_EXIT:
+		instant = "exit";
+		break;
+	case TRACE_RETRY:
+		instant = "retry";
+		break;
+	case TRACE_WAIT:
+		instant = "out of resources";
+		break;
+	case TRACE_HELD:
+		instant = "held by budget";
+		break;
+	case TRACE_KILL:
+		instant = SIGKILL == e->a ? "SIGKILL" : "SIGTERM";
+		break;
+	case TRACE_SKIP:
+		instant = "skipped";
+		break;
+	}
+	if (instant) {
+		g_string_append_printf(gs, ",\n{\"name\":\"%s\",\"ph\":\"i\","
+				       "\"s\":\"t\",\"pid\":1,\"tid\":%u,"
+				       "\"ts\":%" G_GINT64_FORMAT,
+				       instant, tid, e->ts);
+		if (TRACE_RETRY == e->kind) {
+			g_string_append_printf(gs, ",\"args\":{\"delay_ms\":%d}",
+					       e->a);
+		} else if (TRACE_WAIT == e->kind) {
+			g_string_append(gs, ",\"args\":{\"error\":");
+			append_json_string(gs, strerror(e->a));
+			g_string_append(gs, "}");
+		}
+		g_string_append(gs, "}");
+	}
+}
+
+
+static void append_json_string(GString *gs, const char *s)
+{
+	g_string_append_c(gs, '"');
+	for (; *s; s++) {
+		unsigned char c = *s;
+		if ('"' == c || '\\' == c) {
+			g_string_append_c(gs, '\\');
+			g_string_append_c(gs, c);
+		} else if (c < 0x20) {
+			g_string_append_printf(gs, "\\u%04x", c);
+		} else {
+			g_string_append_c(gs, c);
+		}
+	}
+	g_string_append_c(gs, '"');
+}
@@ -0,0 +1,78 @@
+#ifndef trace_h_INCLUDED
+#define trace_h_INCLUDED
+
+#include <glib.h>
+
+#include "names.h"
+
+
+/**
+ * Things that happen in a run, for --trace.
+ */
+enum _traceKind {
+	TRACE_HOST,		/* A host was taken to run */
+	TRACE_SPAWN,		/* A step's ssh was started, a = usec it took */
+	TRACE_CONNECT,		/* ssh says it has connected to the host */
+	TRACE_OUTPUT,		/* A step's first output */
+	TRACE_EXIT,		/* A step's output ended */
+	TRACE_REAP,		/* A step was collected, a = wait() status */
+	TRACE_DONE,		/* The host is finished */
+	TRACE_RETRY,		/* The host will be retried, a = ms to wait */
+	TRACE_WAIT,		/* The host could not start, a = errno */
+	TRACE_RUNNING,		/* a = hosts running, b = how many we allow */
+	TRACE_HELD,		/* Hosts are waiting for the budget */
+	TRACE_KILL,		/* A step timed out, a = the signal sent */
+	TRACE_SKIP,		/* A -N list excluded the host before it started */
+};
+typedef enum _traceKind TraceKind;
+
+
+struct _traceEvent {
+	gint64 ts;		/* usec since the trace started */
+	HostId host;		/* Or NO_HOST */
+	guint32 kind;		/* TraceKind */
+	gint32 a, b;
+};
+typedef struct _traceEvent TraceEvent;
+
+
+/** The ring is made this many events at a time, as it fills. */
+#define TRACE_CHUNK 4096
+
+
+/**
+ * The most recent events, in a ring.  When it fills, the oldest events are
+ * lost.  Worker threads share the ring, each taking the next slot with an
+ * atomic add.
+ */
+struct _trace {
+	TraceEvent **chunks;	/* Each NULL until an event goes in it */
+	guint32 size;		/* A power of two, and a whole number of chunks */
+	gint next;		/* Events so far, atomic */
+	gint64 start;
+	gchar *connect_fifo;	/* ssh's LocalCommand writes to this, or NULL */
+	int connect_fd;		/* Our end of it, or -1 */
+	GString *connect_buf;	/* What we have of the last line */
+	GMutex connect_lock;	/* For one thread at a time to read it */
+};
+typedef struct _trace Trace;
+
+
+/** Note an event, if we are tracing. */
+#define TRACE(fa, kind, host, a, b) \
+	do { \
+		if ((fa)->trace) \
+			trace_event((fa)->trace, kind, host, a, b); \
+	} while (0)
+
+
+// trace.c
+Trace *new_trace(guint32 size);
+void free_trace(Trace *t);
+void trace_event(Trace *t, TraceKind kind, HostId host, gint32 a, gint32 b);
+void trace_connects(Trace *t, GArray *hosts);
+int write_trace(Trace *t, Names *names, const char *filename,
+		GError **error);
+
+
+#endif // trace_h_INCLUDED
@@ -0,0 +1,334 @@
+/*
+ * Copy a file to or from every host.
+ *
+ * Each host has up to two steps.  The first runs md5sum on the host, and if
+ * the remote file is the same as the local one we stop there.  The second
+ * copies the file with cat over ssh.  Both steps share one ssh connection.
+ */
+
+#define _XOPEN_SOURCE 700	/* O_CLOEXEC */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+#include "for-all.h"
+#include "options.h"
+#include "output.h"
+#include "transfer.h"
+#include "utils.h"
+
+
+/** Where each host is up to. */
+enum transfer_state {
+	T_START,		/* Nothing run yet */
+	T_CHECK,		/* Running md5sum on the host */
+	T_COPY,			/* Copying the file */
+	T_SAME,			/* The files are the same, nothing to copy */
+};
+
+
+/**
+ * Per host data for a transfer.
+ */
+struct _transferHost {
+	enum transfer_state state;
+	GString *command;	/* Remote command for the current step */
+	GString *local;		/* For pull, this host's local file */
+	GString *tmp;		/* For pull, where we write until it's done */
+	GString *sum;		/* Output from md5sum on the host */
+	gchar *local_sum;	/* For pull, checksum of the existing file */
+};
+typedef struct _transferHost TransferHost;
+
+
+static gchar *file_checksum(const char *filename);
+static GString *expand_host(GString *template, const char *host);
+static int start_check(HostRun *hr, Transfer *t, TransferHost *th);
+static int start_copy(HostRun *hr, Transfer *t, TransferHost *th);
+static void free_transfer_host(TransferHost *th);
+
+
+/**
+ * Set up a push or pull.  Exits if the local file for a push cannot be read.
+ *
+ * @param fa the hosts, and how to reach them
+ * @param pull TRUE to copy from the hosts, FALSE to copy to them
+ * @param local the local file name, which for pull may contain %h
+ * @param remote the file name on each host
+ */
+Transfer *new_transfer(ForAll *fa, int pull,
+		       const char *local, const char *remote)
+{
+	Transfer *t = g_new0(Transfer, 1);
+	gchar *quoted;
+
+	t->pull = pull;
+	t->local = g_string_new(local);
+	t->remote = g_string_new(remote);
+	quoted = g_shell_quote(remote);
+	t->quoted_remote = g_string_new(quoted);
+	g_free(quoted);
+	t->fa = fa;
+	t->no_stdin = ssh_template(fa, SSH_NO_STDIN | SSH_MUX);
+	t->with_stdin = ssh_template(fa, SSH_MUX);
+	if (! pull) {
+		t->local_sum = file_checksum(local);
+		if (! t->local_sum) {
+			fprintf(stderr, "%s: Cannot read \"%s\": %s\n",
+				myname, local, strerror(errno));
+			exit(3);
+		}
+	}
+	return t;
+}
+
+
+int transfer_step(HostRun *hr, void *data)
+{
+	Transfer *t = (Transfer *) data;
+	TransferHost *th = (TransferHost *) hr->data;
+
+	if (0 == hr->step) {
+		// A retry starts again from scratch.
+		if (th) {
+			free_transfer_host(th);
+		}
+		th = g_new0(TransferHost, 1);
+		hr->data = th;
+		th->command = g_string_new("");
+		th->sum = g_string_new("");
+		if (! opt_quiet) {
+			host_printf(hr, "\n-- %s", hr->host);
+			if (hr->attempt) {
+				host_printf(hr, " (retry %d)", hr->attempt);
+			}
+			host_write(hr, "\n", 1);
+		}
+		if (t->pull) {
+			gchar *dir;
+
+			th->local = expand_host(t->local, hr->host);
+			th->tmp = g_string_new("");
+			g_string_printf(th->tmp, "%s.for-all.%d",
+					th->local->str, (int) getpid());
+			dir = g_path_get_dirname(th->local->str);
+			g_mkdir_with_parents(dir, 0777);
+			g_free(dir);
+			// Only check the remote file if we have a copy already.
+			th->local_sum = file_checksum(th->local->str);
+			if (! th->local_sum) {
+				return start_copy(hr, t, th);
+			}
+		}
+		return start_check(hr, t, th);
+	}
+
+	switch (th->state) {
+	case T_CHECK:
+		if (-1 == hr->status
+		    || (WIFEXITED(hr->status) && 255 == WEXITSTATUS(hr->status))) {
+			// Could not reach the host, so don't try to copy.
+			return FALSE;
+		}
+		if (hr->timed_out || WIFSIGNALED(hr->status)) {
+			// Killed, eg by --timeout, so the host stays failed.
+			return FALSE;
+		}
+		if (WIFEXITED(hr->status) && 0 == WEXITSTATUS(hr->status)) {
+			const char *sum = t->pull ? th->local_sum : t->local_sum;
+			int len = strlen(sum);
+			if (th->sum->len > len
+			    && 0 == strncmp(th->sum->str, sum, len)
+			    && ' ' == th->sum->str[len]) {
+				th->state = T_SAME;
+				return FALSE;
+			}
+		}
+		return start_copy(hr, t, th);
+	default:
+		return FALSE;
+	}
+}
+
+
+/**
+ * Output from the md5sum is kept for checking, and everything else (which
+ * should only be error messages) is shown.
+ */
+void transfer_output(HostRun *hr, const char *buf, int len, void *data)
+{
+	TransferHost *th = (TransferHost *) hr->data;
+
+	if (T_CHECK == th->state) {
+		g_string_append_len(th->sum, buf, len);
+	} else {
+		host_write(hr, buf, len);
+	}
+}
+
+
+/**
+ * Finish off a host.  A pulled file replaces the local one only if the copy
+ * worked.
+ */
+void transfer_done(HostRun *hr, void *data)
+{
+	Transfer *t = (Transfer *) data;
+	TransferHost *th = (TransferHost *) hr->data;
+
+	if (! th) {
+		record_result(t->fa, hr, RESULT_OK);
+		return;
+	}
+	if (T_COPY == th->state && t->pull) {
+		if (-1 != hr->status && WIFEXITED(hr->status)
+		    && 0 == WEXITSTATUS(hr->status)) {
+			if (-1 == rename(th->tmp->str, th->local->str)) {
+				host_printf(hr, "Cannot rename %s: %s\n",
+					    th->tmp->str, strerror(errno));
+				hr->status = 1 << 8;
+			}
+		} else {
+			unlink(th->tmp->str);
+		}
+	}
+	record_result(t->fa, hr, T_SAME == th->state ? RESULT_UNCHANGED : RESULT_OK);
+	free_transfer_host(th);
+	hr->data = 0;
+}
+
+
+static void free_transfer_host(TransferHost *th)
+{
+	g_string_free(th->command, TRUE);
+	g_string_free(th->sum, TRUE);
+	if (th->local) {
+		g_string_free(th->local, TRUE);
+	}
+	if (th->tmp) {
+		g_string_free(th->tmp, TRUE);
+	}
+	g_free(th->local_sum);
+	g_free(th);
+}
+
+
+/**
+ * Run md5sum on the remote file.  The output is "<sum>  -".
+ */
+static int start_check(HostRun *hr, Transfer *t, TransferHost *th)
+{
+	th->state = T_CHECK;
+	g_string_printf(th->command, "{ md5sum < %s; } 2>/dev/null",
+			t->quoted_remote->str);
+	host_args(t->fa, hr, t->no_stdin);
+	ga(hr->args, g2c(th->command));
+	return TRUE;
+}
+
+
+/**
+ * Copy the file.  For push, the local file is the child's stdin, and the
+ * remote side writes a temporary file then moves it into place.  For pull,
+ * the child's stdout goes to a temporary file that transfer_done() renames.
+ */
+static int start_copy(HostRun *hr, Transfer *t, TransferHost *th)
+{
+	th->state = T_COPY;
+	if (t->pull) {
+		hr->out_fd = open(th->tmp->str, O_WRONLY | O_CREAT | O_TRUNC
+				  | O_CLOEXEC, 0666);
+		if (-1 == hr->out_fd) {
+			hr->error = errno;
+			hr->status = -1;
+			host_printf(hr, "Cannot open %s: %s\n",
+				    th->tmp->str, strerror(errno));
+			return FALSE;
+		}
+		g_string_printf(th->command, "cat %s", t->quoted_remote->str);
+	} else {
+		hr->in_fd = open(t->local->str, O_RDONLY | O_CLOEXEC);
+		if (-1 == hr->in_fd) {
+			hr->error = errno;
+			hr->status = -1;
+			host_printf(hr, "Cannot open %s: %s\n",
+				    t->local->str, strerror(errno));
+			return FALSE;
+		}
+		g_string_printf(th->command,
+				"t=%s.for-all.$$ && cat > \"$t\""
+				" && mv -f \"$t\" %s",
+				t->quoted_remote->str, t->quoted_remote->str);
+	}
+	host_args(t->fa, hr, t->pull ? t->no_stdin : t->with_stdin);
+	ga(hr->args, g2c(th->command));
+	return TRUE;
+}
+
+
+/**
+ * Work out the md5 checksum of a local file.
+ *
+ * @return a newly allocated hex string, or NULL if the file cannot be read
+ */
+static gchar *file_checksum(const char *filename)
+{
+	GChecksum *cs;
+	gchar *sum;
+	FILE *f;
+	guchar buf[8192];
+	size_t n;
+
+	f = fopen(filename, "r");
+	if (! f) {
+		return 0;
+	}
+	cs = g_checksum_new(G_CHECKSUM_MD5);
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+		g_checksum_update(cs, buf, n);
+	}
+	if (ferror(f)) {
+		fclose(f);
+		g_checksum_free(cs);
+		return 0;
+	}
+	fclose(f);
+	sum = g_strdup(g_checksum_get_string(cs));
+	g_checksum_free(cs);
+	return sum;
+}
+
+
+/**
+ * Replace %h in a file name with the host name, and %% with %.
+ *
+ * @return a new GString
+ */
+static GString *expand_host(GString *template, const char *host)
+{
+	GString *gs = g_string_new("");
+
+	for (int i=0; i<template->len; i++) {
+		char c = template->str[i];
+		if ('%' == c && i+1 < template->len) {
+			char n = template->str[i+1];
+			if ('h' == n) {
+				g_string_append(gs, host);
+				i++;
+				continue;
+			} else if ('%' == n) {
+				g_string_append_c(gs, '%');
+				i++;
+				continue;
+			}
+		}
+		g_string_append_c(gs, c);
+	}
+	return gs;
+}
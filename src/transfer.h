@@ -0,0 +1,33 @@
+#ifndef transfer_h_INCLUDED
+#define transfer_h_INCLUDED
+
+#include <glib.h>
+
+#include "run-command.h"
+
+
+/**
+ * A file to copy to or from every host.
+ */
+struct _transfer {
+	int pull;		/* TRUE to copy from the hosts */
+	GString *local;		/* Local file, or for pull a %h template */
+	GString *remote;	/* File on each host */
+	GString *quoted_remote;	/* remote, quoted for the remote shell */
+	ForAll *fa;		/* The hosts, and how to reach them */
+	gchar *local_sum;	/* For push, checksum of the local file */
+	Template *no_stdin;	/* ssh for the check, and for pull */
+	Template *with_stdin;	/* ssh for push, with the file as stdin */
+};
+typedef struct _transfer Transfer;
+
+
+// transfer.c
+Transfer *new_transfer(ForAll *fa, int pull,
+		       const char *local, const char *remote);
+int transfer_step(HostRun *hr, void *data);
+void transfer_output(HostRun *hr, const char *buf, int len, void *data);
+void transfer_done(HostRun *hr, void *data);
+
+
+#endif // transfer_h_INCLUDED
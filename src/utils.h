@@ -18,13 +18,7 @@
 #define a2c(p, i) ( (char*)(g_ptr_array_index(p,i)) )
 
 // Add pointer to array.
-#define ga(a,p)								\
-	do {								\
-		if (0 && opt_debug) {					\
-			printf("adding to %s: %p\n", #a, (void*)p);	\
-		}							\
-		g_ptr_array_add(a,p);					\
-	} while (0)
+#define ga(a,p)   g_ptr_array_add(a,p)
 
 
 #endif // utils_h_INCLUDED
@@ -0,0 +1,125 @@
+/*
+ * Watching the -N lists while the hosts run.  A long run over the fleet can
+ * meet an incident part way through, when someone adds the hosts involved to
+ * an exclusion list.  With the lists watched, the hosts that have not started
+ * yet are skipped, and the run does not have to be killed and started again.
+ *
+ * As in the daemon, we watch the directories rather than the files, which
+ * catches editors that write a new file and rename it into place.
+ */
+
+#include <glib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "watch.h"
+
+
+/**
+ * Get ready to watch directories, with watch_list_dir().
+ *
+ * @return a new ListWatch, or NULL if we have no way to watch them
+ */
+ListWatch *new_list_watch(void)
+{
+#ifdef __linux__
+	ListWatch *w;
+	int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (-1 == fd) {
+		return 0;
+	}
+	w = g_new0(ListWatch, 1);
+	w->fd = fd;
+	w->nots = new_bitset();
+	w->old = g_ptr_array_new();
+	return w;
+#else
+	return 0;
+#endif
+}
+
+
+/**
+ * Watch one more directory.  Watching one twice is the same as once.
+ */
+void watch_list_dir(ListWatch *w, const char *dir)
+{
+#ifdef __linux__
+	// A directory that has gone has no lists to change.
+	inotify_add_watch(w->fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO
+			  | IN_MOVED_FROM | IN_DELETE);
+#endif
+}
+
+
+/**
+ * Free the watch once no Runner is using it.
+ */
+void free_list_watch(ListWatch *w)
+{
+	close(w->fd);
+	free_bitset(w->nots);
+	for (int i=0; i<w->old->len; i++) {
+		free_bitset(g_ptr_array_index(w->old, i));
+	}
+	g_ptr_array_free(w->old, TRUE);
+	g_free(w);
+}
+
+
+/**
+ * Has anything changed in the directories since we last looked?  This does
+ * not wait, and any number of changes count as one.
+ */
+int watch_changed(ListWatch *w)
+{
+	int changed = FALSE;
+#ifdef __linux__
+	char buf[4096]
+		__attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	while (read(w->fd, buf, sizeof(buf)) > 0) {
+		changed = TRUE;
+	}
+#endif
+	return changed;
+}
+
+
+/**
+ * Exclude the hosts in nots, as well as those already excluded.  A host that
+ * was taken out of a list stays excluded, as it may have been skipped by now.
+ *
+ * @return how many more hosts are excluded
+ */
+int watch_add(ListWatch *w, Bitset *nots)
+{
+	Bitset *set = new_bitset();
+	int added;
+
+	bitset_union(set, w->nots);
+	bitset_union(set, nots);
+	added = bitset_count(set) - bitset_count(w->nots);
+	if (! added) {
+		free_bitset(set);
+		return 0;
+	}
+	// Runners may still have the old set in hand.
+	g_ptr_array_add(w->old, w->nots);
+	g_atomic_pointer_set(&w->nots, set);
+	return added;
+}
+
+
+/**
+ * Has a list excluded the host since the run began?  Any thread can ask.
+ */
+int watch_excluded(ListWatch *w, HostId id)
+{
+	Bitset *nots = g_atomic_pointer_get(&w->nots);
+
+	return bitset_has(nots, id);
+}
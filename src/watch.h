@@ -0,0 +1,34 @@
+#ifndef watch_h_INCLUDED
+#define watch_h_INCLUDED
+
+#include <glib.h>
+
+#include "bitset.h"
+#include "names.h"
+
+
+/**
+ * Directories of list files, watched while the hosts run, and the hosts that
+ * the lists in them have excluded since the run began.  Runners on any thread
+ * look at nots.  Only the thread that calls watch_add() changes it, and it
+ * does that by putting a new set in its place.
+ */
+struct _listWatch {
+	int fd;			/* inotify */
+	Bitset *nots;		/* Hosts excluded so far, read atomically */
+	GPtrArray *old;		/* Bitset*, sets that nots replaced, which a
+				   Runner may still be looking at */
+};
+typedef struct _listWatch ListWatch;
+
+
+// watch.c
+ListWatch *new_list_watch(void);
+void watch_list_dir(ListWatch *w, const char *dir);
+void free_list_watch(ListWatch *w);
+int watch_changed(ListWatch *w);
+int watch_add(ListWatch *w, Bitset *nots);
+int watch_excluded(ListWatch *w, HostId id);
+
+
+#endif // watch_h_INCLUDED